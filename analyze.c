@@ -0,0 +1,457 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "analyze.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define ANALYZE_X86
+  #include <immintrin.h>
+#endif
+
+// number of frames processed at once for all channels
+#define ANALYZE_TILE_FRAMES     64
+
+// any sample at or beyond full scale must have ended up as minimum or maximum
+#define ANALYZE_CLIPPING(p)     ((p).maxi >= 1.0f || (p).mini <= -1.0f)
+
+// contiguous frames are processed in steps of at most this many vectors, enough for
+// the lanes to line up with the channels again for up to 8 channels per vector
+#define ANALYZE_MAX_REPEAT      8
+
+
+static void analyze_frames_scalar(sample_t const *, unsigned int, int, int, analyze_peak *);
+static void analyze_frames_rms_scalar(sample_t const *, unsigned int, int, int, analyze_peak *);
+static void analyze_histogram_scalar(sample_t const *, unsigned int, int, int, analyze_hist *);
+static unsigned int analyze_find_trigger_scalar(sample_t const *, unsigned int, int, int, analyze_trigger *);
+
+void (*analyze_frames)(sample_t const *, unsigned int, int, int, analyze_peak *) = analyze_frames_scalar;
+void (*analyze_histogram)(sample_t const *, unsigned int, int, int, analyze_hist *) = analyze_histogram_scalar;
+unsigned int (*analyze_find_trigger)(sample_t const *, unsigned int, int, int, analyze_trigger *) =
+    analyze_find_trigger_scalar;
+
+
+// with rms being a constant, the compiler makes two separate functions out of this one,
+// so the min/max-only version doesn't do any extra work
+static inline __attribute__((always_inline))
+void analyze_frames_scalar_impl(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                                analyze_peak *peaks, bool rms)
+{
+    for (int c = 0; c < nchannels; c++)
+    {
+        sample_t const *f = frames + c;
+        sample_t maxi = peaks[c].maxi;
+        sample_t mini = peaks[c].mini;
+        float sumsq = 0.0f;
+
+        // find maximum and minimum sample value
+        for (unsigned int i = 0; i < nframes; i++) {
+            sample_t s = f[(size_t)i * stride];
+            maxi = s > maxi ? s : maxi;
+            mini = s < mini ? s : mini;
+            if (rms) sumsq += s * s;
+        }
+
+        peaks[c].maxi = maxi;
+        peaks[c].mini = mini;
+        peaks[c].clipping = ANALYZE_CLIPPING(peaks[c]);
+        if (rms) {
+            peaks[c].sumsq += sumsq;
+            peaks[c].count += nframes;
+        }
+    }
+}
+
+
+static void analyze_frames_scalar(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                                  analyze_peak *peaks)
+{
+    analyze_frames_scalar_impl(frames, nframes, stride, nchannels, peaks, false);
+}
+
+
+static void analyze_frames_rms_scalar(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                                      analyze_peak *peaks)
+{
+    analyze_frames_scalar_impl(frames, nframes, stride, nchannels, peaks, true);
+}
+
+
+static void analyze_histogram_scalar(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                                     analyze_hist *hists)
+{
+    for (int c = 0; c < nchannels; c++)
+    {
+        sample_t const *f = frames + c;
+        analyze_hist *h = &hists[c];
+        float top = h->nbins - 1;
+
+        for (unsigned int i = 0; i < nframes; i++) {
+            float y = h->offset - f[(size_t)i * stride] * h->scale;
+            // (this way round, NaN ends up in row 0)
+            y = y > 0.0f ? y : 0.0f;
+            y = y < top ? y : top;
+            h->bins[(i % ANALYZE_HIST_COPIES) * h->nbins + (int)y]++;
+        }
+    }
+}
+
+
+static unsigned int analyze_find_trigger_scalar(sample_t const *frames, unsigned int nframes, int stride, int channel,
+                                                analyze_trigger *trig)
+{
+    sample_t const *f = frames + channel;
+    bool armed = trig->armed;
+
+    for (unsigned int i = 0; i < nframes; i++) {
+        sample_t x = f[(size_t)i * stride] * trig->sign;
+        if (armed && x >= trig->level) {
+            trig->armed = false;
+            return i;
+        }
+        armed = armed || x < trig->rearm;
+    }
+
+    trig->armed = armed;
+    return nframes;
+}
+
+
+#ifdef ANALYZE_X86
+
+static inline int analyze_gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// counts the rows in the four lanes of x, each in the histogram b[0] .. b[3] points to.
+// taking the rows straight out of the register is faster than storing them first
+#define HIST_COUNT4(x, b) do { \
+        __m128i _x = (x); \
+        (b)[0][_mm_cvtsi128_si32(_x)]++; \
+        (b)[1][_mm_cvtsi128_si32(_mm_srli_si128(_x, 4))]++; \
+        (b)[2][_mm_cvtsi128_si32(_mm_srli_si128(_x, 8))]++; \
+        (b)[3][_mm_cvtsi128_si32(_mm_srli_si128(_x, 12))]++; \
+    } while (0)
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define ANALYZE_FUNC    analyze_frames_sse2
+#define ANALYZE_RMS_FUNC analyze_frames_rms_sse2
+#define ANALYZE_IMPL    analyze_frames_impl_sse2
+#define ANALYZE_REPEAT  analyze_frames_repeat_sse2
+#define ANALYZE_NARROW_FUNC analyze_frames_scalar
+#define ANALYZE_NARROW_RMS_FUNC analyze_frames_rms_scalar
+#define HIST_FUNC       analyze_histogram_sse2
+#define HIST_REPEAT     analyze_histogram_repeat_sse2
+#define HIST_NARROW_FUNC analyze_histogram_scalar
+#define FIND_FUNC       analyze_find_trigger_sse2
+#define ANALYZE_WIDTH   4
+#define vec_t           __m128
+#define VEC_LOADU       _mm_loadu_ps
+#define VEC_STOREU      _mm_storeu_ps
+#define VEC_MIN         _mm_min_ps
+#define VEC_MAX         _mm_max_ps
+#define VEC_SET1        _mm_set1_ps
+#define VEC_MUL         _mm_mul_ps
+#define VEC_ADD         _mm_add_ps
+#define VEC_SUB         _mm_sub_ps
+#define VEC_GE_MASK(a, b) (unsigned int)_mm_movemask_ps(_mm_cmpge_ps(a, b))
+#define VEC_LT_MASK(a, b) (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(a, b))
+#define VEC_INDEX       _mm_cvttps_epi32
+#define VEC_COUNT(v, b) HIST_COUNT4(v, b)
+#include "analyze_simd.h"
+#undef ANALYZE_FUNC
+#undef ANALYZE_RMS_FUNC
+#undef ANALYZE_IMPL
+#undef ANALYZE_REPEAT
+#undef ANALYZE_NARROW_FUNC
+#undef ANALYZE_NARROW_RMS_FUNC
+#undef HIST_FUNC
+#undef HIST_REPEAT
+#undef HIST_NARROW_FUNC
+#undef FIND_FUNC
+#undef ANALYZE_WIDTH
+#undef vec_t
+#undef VEC_LOADU
+#undef VEC_STOREU
+#undef VEC_MIN
+#undef VEC_MAX
+#undef VEC_SET1
+#undef VEC_MUL
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_GE_MASK
+#undef VEC_LT_MASK
+#undef VEC_INDEX
+#undef VEC_COUNT
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define ANALYZE_FUNC    analyze_frames_avx2
+#define ANALYZE_RMS_FUNC analyze_frames_rms_avx2
+#define ANALYZE_IMPL    analyze_frames_impl_avx2
+#define ANALYZE_REPEAT  analyze_frames_repeat_avx2
+#define ANALYZE_NARROW_FUNC analyze_frames_sse2
+#define ANALYZE_NARROW_RMS_FUNC analyze_frames_rms_sse2
+#define HIST_FUNC       analyze_histogram_avx2
+#define HIST_REPEAT     analyze_histogram_repeat_avx2
+#define HIST_NARROW_FUNC analyze_histogram_sse2
+#define FIND_FUNC       analyze_find_trigger_avx2
+#define ANALYZE_WIDTH   8
+#define vec_t           __m256
+#define VEC_LOADU       _mm256_loadu_ps
+#define VEC_STOREU      _mm256_storeu_ps
+#define VEC_MIN         _mm256_min_ps
+#define VEC_MAX         _mm256_max_ps
+#define VEC_SET1        _mm256_set1_ps
+#define VEC_MUL         _mm256_mul_ps
+#define VEC_ADD         _mm256_add_ps
+#define VEC_SUB         _mm256_sub_ps
+#define VEC_GE_MASK(a, b) (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ))
+#define VEC_LT_MASK(a, b) (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ))
+#define VEC_INDEX       _mm256_cvttps_epi32
+#define VEC_COUNT(v, b) do { HIST_COUNT4(_mm256_castsi256_si128(v), b); \
+                             HIST_COUNT4(_mm256_extracti128_si256(v, 1), (b) + 4); } while (0)
+#include "analyze_simd.h"
+#undef ANALYZE_FUNC
+#undef ANALYZE_RMS_FUNC
+#undef ANALYZE_IMPL
+#undef ANALYZE_REPEAT
+#undef ANALYZE_NARROW_FUNC
+#undef ANALYZE_NARROW_RMS_FUNC
+#undef HIST_FUNC
+#undef HIST_REPEAT
+#undef HIST_NARROW_FUNC
+#undef FIND_FUNC
+#undef ANALYZE_WIDTH
+#undef vec_t
+#undef VEC_LOADU
+#undef VEC_STOREU
+#undef VEC_MIN
+#undef VEC_MAX
+#undef VEC_SET1
+#undef VEC_MUL
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_GE_MASK
+#undef VEC_LT_MASK
+#undef VEC_INDEX
+#undef VEC_COUNT
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// (the channels left over are passed on to the avx2 kernels. every cpu with
+// avx512f also has avx2)
+// (avx512f comes with FMA, which would round the rows of some samples differently)
+#pragma GCC optimize("fp-contract=off")
+#define ANALYZE_FUNC    analyze_frames_avx512
+#define ANALYZE_RMS_FUNC analyze_frames_rms_avx512
+#define ANALYZE_IMPL    analyze_frames_impl_avx512
+#define ANALYZE_REPEAT  analyze_frames_repeat_avx512
+#define ANALYZE_NARROW_FUNC analyze_frames_avx2
+#define ANALYZE_NARROW_RMS_FUNC analyze_frames_rms_avx2
+#define HIST_FUNC       analyze_histogram_avx512
+#define HIST_REPEAT     analyze_histogram_repeat_avx512
+#define HIST_NARROW_FUNC analyze_histogram_avx2
+#define FIND_FUNC       analyze_find_trigger_avx512
+#define ANALYZE_WIDTH   16
+#define vec_t           __m512
+#define VEC_LOADU       _mm512_loadu_ps
+#define VEC_STOREU      _mm512_storeu_ps
+#define VEC_MIN         _mm512_min_ps
+#define VEC_MAX         _mm512_max_ps
+#define VEC_SET1        _mm512_set1_ps
+#define VEC_MUL         _mm512_mul_ps
+#define VEC_ADD         _mm512_add_ps
+#define VEC_SUB         _mm512_sub_ps
+#define VEC_GE_MASK(a, b) (unsigned int)_mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#define VEC_LT_MASK(a, b) (unsigned int)_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define VEC_INDEX       _mm512_cvttps_epi32
+#define VEC_COUNT(v, b) do { HIST_COUNT4(_mm512_extracti32x4_epi32(v, 0), b); \
+                             HIST_COUNT4(_mm512_extracti32x4_epi32(v, 1), (b) + 4); \
+                             HIST_COUNT4(_mm512_extracti32x4_epi32(v, 2), (b) + 8); \
+                             HIST_COUNT4(_mm512_extracti32x4_epi32(v, 3), (b) + 12); } while (0)
+#include "analyze_simd.h"
+#undef ANALYZE_FUNC
+#undef ANALYZE_RMS_FUNC
+#undef ANALYZE_IMPL
+#undef ANALYZE_REPEAT
+#undef ANALYZE_NARROW_FUNC
+#undef ANALYZE_NARROW_RMS_FUNC
+#undef HIST_FUNC
+#undef HIST_REPEAT
+#undef HIST_NARROW_FUNC
+#undef FIND_FUNC
+#undef ANALYZE_WIDTH
+#undef vec_t
+#undef VEC_LOADU
+#undef VEC_STOREU
+#undef VEC_MIN
+#undef VEC_MAX
+#undef VEC_SET1
+#undef VEC_MUL
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_GE_MASK
+#undef VEC_LT_MASK
+#undef VEC_INDEX
+#undef VEC_COUNT
+#pragma GCC pop_options
+
+#undef HIST_COUNT4
+
+#endif // ANALYZE_X86
+
+
+typedef struct {
+    const char *name;
+    int width;
+    void (*frames)(sample_t const *, unsigned int, int, int, analyze_peak *);
+    void (*frames_rms)(sample_t const *, unsigned int, int, int, analyze_peak *);
+    void (*histogram)(sample_t const *, unsigned int, int, int, analyze_hist *);
+    unsigned int (*find_trigger)(sample_t const *, unsigned int, int, int, analyze_trigger *);
+    bool (*supported)();
+} analyze_impl;
+
+static bool analyze_supported_always() { return true; }
+
+#ifdef ANALYZE_X86
+static bool analyze_supported_sse2() { return __builtin_cpu_supports("sse2"); }
+static bool analyze_supported_avx2() { return __builtin_cpu_supports("avx2"); }
+static bool analyze_supported_avx512() { return __builtin_cpu_supports("avx512f"); }
+#endif
+
+// best implementation first
+static const analyze_impl impls[] = {
+#ifdef ANALYZE_X86
+    { "avx512", 16, analyze_frames_avx512, analyze_frames_rms_avx512, analyze_histogram_avx512,
+                    analyze_find_trigger_avx512, analyze_supported_avx512 },
+    { "avx2",    8, analyze_frames_avx2,   analyze_frames_rms_avx2,   analyze_histogram_avx2,
+                    analyze_find_trigger_avx2,   analyze_supported_avx2 },
+    { "sse2",    4, analyze_frames_sse2,   analyze_frames_rms_sse2,   analyze_histogram_sse2,
+                    analyze_find_trigger_sse2,   analyze_supported_sse2 },
+#endif
+    { "scalar",  1, analyze_frames_scalar, analyze_frames_rms_scalar, analyze_histogram_scalar,
+                    analyze_find_trigger_scalar, analyze_supported_always },
+};
+
+static const analyze_impl *impl = &impls[sizeof(impls) / sizeof(impls[0]) - 1];
+static bool rms = false;
+
+
+void analyze_init()
+{
+#ifdef ANALYZE_X86
+    __builtin_cpu_init();
+#endif
+
+    for (size_t n = 0; n < sizeof(impls) / sizeof(impls[0]); n++) {
+        if (impls[n].supported()) {
+            impl = &impls[n];
+            analyze_frames = rms ? impl->frames_rms : impl->frames;
+            analyze_histogram = impl->histogram;
+            analyze_find_trigger = impl->find_trigger;
+            return;
+        }
+    }
+}
+
+
+bool analyze_select(const char *name)
+{
+    for (size_t n = 0; n < sizeof(impls) / sizeof(impls[0]); n++) {
+        if (strcmp(impls[n].name, name) == 0 && impls[n].supported()) {
+            impl = &impls[n];
+            analyze_frames = rms ? impl->frames_rms : impl->frames;
+            analyze_histogram = impl->histogram;
+            analyze_find_trigger = impl->find_trigger;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char * analyze_get_name()
+{
+    return impl->name;
+}
+
+
+// the number of channels the current kernels process at once
+int analyze_get_width()
+{
+    return impl->width;
+}
+
+
+// switches between the kernels finding just minimum and maximum, and those
+// that also sum up the squares of the samples
+void analyze_set_rms(bool enable)
+{
+    rms = enable;
+    analyze_frames = rms ? impl->frames_rms : impl->frames;
+}
+
+
+void analyze_reset(analyze_peak *peaks, int n)
+{
+    for (int i = 0; i < n; i++) {
+        peaks[i].mini = FLT_MAX;
+        peaks[i].maxi = -FLT_MAX;
+        peaks[i].clipping = false;
+        peaks[i].sumsq = 0.0f;
+        peaks[i].count = 0;
+    }
+}
+
+
+// the trigger starts out disarmed, the signal has to be on the other side of the
+// hysteresis first
+void analyze_trigger_init(analyze_trigger *trig, float level, bool falling, float hysteresis)
+{
+    trig->sign = falling ? -1.0f : 1.0f;
+    trig->level = level * trig->sign;
+    trig->rearm = trig->level - hysteresis;
+    trig->armed = false;
+}
+
+
+void analyze_hist_reset(analyze_hist *hists, int n)
+{
+    for (int i = 0; i < n; i++) {
+        memset(hists[i].bins, 0, ANALYZE_HIST_COPIES * hists[i].nbins * sizeof(unsigned int));
+    }
+}
+
+
+// combines two summaries of adjacent samples
+void analyze_merge(analyze_peak *dst, analyze_peak const *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (src[i].mini < dst[i].mini) dst[i].mini = src[i].mini;
+        if (src[i].maxi > dst[i].maxi) dst[i].maxi = src[i].maxi;
+        dst[i].clipping |= src[i].clipping;
+        dst[i].sumsq += src[i].sumsq;
+        dst[i].count += src[i].count;
+    }
+}
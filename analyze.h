@@ -0,0 +1,98 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _ANALYZE_H
+#define _ANALYZE_H
+
+#include <stdbool.h>
+#include <math.h>
+
+#include "audio.h"
+
+// summary of one track's samples in one column.
+// sumsq and count are only filled in after analyze_set_rms(true)
+typedef struct analyze_peak {
+    sample_t mini;
+    sample_t maxi;
+    bool clipping;
+    float sumsq;
+    unsigned int count;
+} analyze_peak;
+
+// each histogram is kept in several copies, so that consecutive samples falling into
+// the same bin don't have to wait for each other to be counted
+#define ANALYZE_HIST_COPIES     4
+
+// distribution of one track's samples over the rows of a column.
+// a sample s is counted in row (offset - s * scale), clamped to 0 .. nbins - 1
+typedef struct analyze_hist {
+    float offset;
+    float scale;
+    int nbins;
+    unsigned int *bins;     // ANALYZE_HIST_COPIES * nbins counters
+} analyze_hist;
+
+// state of the search for a trigger. samples are multiplied by sign first, and so are
+// level and rearm, so a falling edge is found just like a rising one
+typedef struct analyze_trigger {
+    float sign;
+    float level;
+    float rearm;
+    bool armed;
+} analyze_trigger;
+
+void analyze_init();
+bool analyze_select(const char *name);
+const char * analyze_get_name();
+int analyze_get_width();
+void analyze_set_rms(bool rms);
+
+void analyze_reset(analyze_peak *peaks, int n);
+void analyze_merge(analyze_peak *dst, analyze_peak const *src, int n);
+
+// root mean square of the samples, 0 if that wasn't computed
+static inline sample_t analyze_rms(analyze_peak const *peak)
+{
+    return peak->count ? sqrtf(peak->sumsq / peak->count) : 0.0f;
+}
+
+void analyze_hist_reset(analyze_hist *hists, int n);
+
+void analyze_trigger_init(analyze_trigger *trig, float level, bool falling, float hysteresis);
+
+// number of samples counted in the given row
+static inline unsigned int analyze_hist_get(analyze_hist const *hist, int bin)
+{
+    unsigned int count = 0;
+    for (int k = 0; k < ANALYZE_HIST_COPIES; k++) {
+        count += hist->bins[k * hist->nbins + bin];
+    }
+    return count;
+}
+
+// analyzes nframes frames, stride samples apart, updating the peaks of
+// the first nchannels samples in each frame. the sum of squares is computed
+// in the same pass, if enabled
+extern void (*analyze_frames)(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                              analyze_peak *peaks);
+
+// counts nframes frames, stride samples apart, in the histograms of
+// the first nchannels samples in each frame
+extern void (*analyze_histogram)(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                                 analyze_hist *hists);
+
+// searches nframes frames, stride samples apart, for the first one whose sample of the given
+// channel crosses the trigger level, after having been on the other side of the hysteresis
+// before. returns its index, or nframes if there's none
+extern unsigned int (*analyze_find_trigger)(sample_t const *frames, unsigned int nframes, int stride, int channel,
+                                            analyze_trigger *trig);
+
+#endif // _ANALYZE_H
@@ -0,0 +1,371 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * vectorized versions of analyze_frames_scalar(), analyze_frames_rms_scalar(),
+ * analyze_histogram_scalar() and analyze_find_trigger_scalar(), included by analyze.c
+ * once for every instruction set. expects ANALYZE_FUNC, ANALYZE_RMS_FUNC, ANALYZE_IMPL,
+ * ANALYZE_REPEAT, ANALYZE_NARROW_FUNC, ANALYZE_NARROW_RMS_FUNC, HIST_FUNC, HIST_REPEAT,
+ * HIST_NARROW_FUNC, FIND_FUNC, ANALYZE_WIDTH, vec_t, VEC_LOADU, VEC_STOREU, VEC_MIN,
+ * VEC_MAX, VEC_SET1, VEC_MUL, VEC_ADD, VEC_SUB, VEC_GE_MASK, VEC_LT_MASK, VEC_INDEX and
+ * VEC_COUNT to be defined.
+ *
+ * VEC_MIN(a, b) and VEC_MAX(a, b) must behave exactly like (a < b ? a : b) and
+ * (a > b ? a : b), so that the results are the same as with the scalar code.
+ * VEC_INDEX(v) truncates v to ints, VEC_COUNT(v, b) counts lane l of those in
+ * the histogram b[l] points to. VEC_GE_MASK(a, b) and VEC_LT_MASK(a, b) return a bit
+ * for every lane where a >= b or a < b, false for NaN.
+ *
+ * ANALYZE_NARROW_FUNC, ANALYZE_NARROW_RMS_FUNC and HIST_NARROW_FUNC are the kernels of
+ * the next narrower instruction set, which take the channels that don't fill a whole vector.
+ */
+
+// contiguous frames, nv vectors at a time. nv * W is a multiple of nchannels, so each
+// lane of each of the nv vectors always sees the same channel.
+// the squares are summed up from the same loads as minimum and maximum, so the
+// samples are still only read once
+static inline __attribute__((always_inline))
+void ANALYZE_REPEAT(sample_t const *frames, size_t n, int nchannels, const int nv,
+                    analyze_peak *peaks, bool rms)
+{
+    const int W = ANALYZE_WIDTH;
+    const int L = nv * W;
+
+    sample_t lmin[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    sample_t lmax[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    sample_t lsum[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    for (int l = 0; l < L; l++) {
+        lmin[l] = peaks[l % nchannels].mini;
+        lmax[l] = peaks[l % nchannels].maxi;
+    }
+
+    vec_t vmin[ANALYZE_MAX_REPEAT], vmax[ANALYZE_MAX_REPEAT], vsum[ANALYZE_MAX_REPEAT];
+    for (int k = 0; k < nv; k++) {
+        vmin[k] = VEC_LOADU(lmin + k * W);
+        vmax[k] = VEC_LOADU(lmax + k * W);
+        vsum[k] = VEC_SET1(0.0f);
+    }
+
+    size_t i = 0;
+
+    for (; i + L <= n; i += L) {
+        for (int k = 0; k < nv; k++) {
+            vec_t a = VEC_LOADU(frames + i + k * W);
+            vmin[k] = VEC_MIN(a, vmin[k]);
+            vmax[k] = VEC_MAX(a, vmax[k]);
+            if (rms) vsum[k] = VEC_ADD(vsum[k], VEC_MUL(a, a));
+        }
+    }
+    // fewer than nv vectors left, each still in its own lanes
+    for (int k = 0; k < nv && i + W <= n; k++, i += W) {
+        vec_t a = VEC_LOADU(frames + i);
+        vmin[k] = VEC_MIN(a, vmin[k]);
+        vmax[k] = VEC_MAX(a, vmax[k]);
+        if (rms) vsum[k] = VEC_ADD(vsum[k], VEC_MUL(a, a));
+    }
+
+    for (int k = 0; k < nv; k++) {
+        VEC_STOREU(lmin + k * W, vmin[k]);
+        VEC_STOREU(lmax + k * W, vmax[k]);
+        VEC_STOREU(lsum + k * W, vsum[k]);
+    }
+
+    for (; i < n; i++) {
+        sample_t s = frames[i];
+        int l = i % L;
+        lmin[l] = s < lmin[l] ? s : lmin[l];
+        lmax[l] = s > lmax[l] ? s : lmax[l];
+        lsum[l] += s * s;
+    }
+
+    for (int l = 0; l < L; l++) {
+        analyze_peak *p = &peaks[l % nchannels];
+        p->mini = lmin[l] < p->mini ? lmin[l] : p->mini;
+        p->maxi = lmax[l] > p->maxi ? lmax[l] : p->maxi;
+        if (rms) p->sumsq += lsum[l];
+    }
+    for (int c = 0; c < nchannels; c++) {
+        peaks[c].clipping = ANALYZE_CLIPPING(peaks[c]);
+        if (rms) peaks[c].count += n / nchannels;
+    }
+}
+
+
+static inline __attribute__((always_inline))
+void ANALYZE_IMPL(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                  analyze_peak *peaks, bool rms)
+{
+    const int W = ANALYZE_WIDTH;
+
+    if (stride == nchannels && (nchannels <= W || nchannels % W))
+    {
+        // contiguous frames, unless whole vectors of channels can be tiled below.
+        // nv is the number of vectors after which the lanes see the same channels
+        // again. it's passed as a constant, so the accumulators can stay in registers
+        size_t n = (size_t)nframes * nchannels;
+        switch (nchannels / analyze_gcd(W, nchannels)) {
+            // (at least two vectors, to have two of them in flight)
+            case 1:
+            case 2: ANALYZE_REPEAT(frames, n, nchannels, 2, peaks, rms); return;
+            case 3: ANALYZE_REPEAT(frames, n, nchannels, 3, peaks, rms); return;
+            case 4: ANALYZE_REPEAT(frames, n, nchannels, 4, peaks, rms); return;
+            case 5: ANALYZE_REPEAT(frames, n, nchannels, 5, peaks, rms); return;
+            case 6: ANALYZE_REPEAT(frames, n, nchannels, 6, peaks, rms); return;
+            case 7: ANALYZE_REPEAT(frames, n, nchannels, 7, peaks, rms); return;
+            case 8: ANALYZE_REPEAT(frames, n, nchannels, 8, peaks, rms); return;
+            default: break;
+        }
+    }
+
+    // otherwise, process W adjacent channels at a time, in tiles of frames small enough
+    // to stay in the cache until all channels are done
+    int nblock = nchannels - nchannels % W;
+
+    if (nblock)
+    {
+        sample_t tmin[nblock], tmax[nblock], tsum[nblock];
+        for (int c = 0; c < nblock; c++) {
+            tmin[c] = peaks[c].mini;
+            tmax[c] = peaks[c].maxi;
+            tsum[c] = 0.0f;
+        }
+
+        for (unsigned int i0 = 0; i0 < nframes; i0 += ANALYZE_TILE_FRAMES)
+        {
+            unsigned int i1 = nframes - i0 > ANALYZE_TILE_FRAMES ? i0 + ANALYZE_TILE_FRAMES : nframes;
+
+            for (int c = 0; c < nblock; c += W)
+            {
+                sample_t const *f = frames + c;
+                vec_t vmin0 = VEC_LOADU(tmin + c), vmin1 = vmin0;
+                vec_t vmax0 = VEC_LOADU(tmax + c), vmax1 = vmax0;
+                vec_t vsum0 = VEC_LOADU(tsum + c), vsum1 = VEC_SET1(0.0f);
+                unsigned int i = i0;
+
+                for (; i + 2 <= i1; i += 2) {
+                    vec_t a = VEC_LOADU(f + (size_t)i * stride);
+                    vec_t b = VEC_LOADU(f + (size_t)(i + 1) * stride);
+                    vmin0 = VEC_MIN(a, vmin0);
+                    vmax0 = VEC_MAX(a, vmax0);
+                    vmin1 = VEC_MIN(b, vmin1);
+                    vmax1 = VEC_MAX(b, vmax1);
+                    if (rms) {
+                        vsum0 = VEC_ADD(vsum0, VEC_MUL(a, a));
+                        vsum1 = VEC_ADD(vsum1, VEC_MUL(b, b));
+                    }
+                }
+                if (i < i1) {
+                    vec_t a = VEC_LOADU(f + (size_t)i * stride);
+                    vmin0 = VEC_MIN(a, vmin0);
+                    vmax0 = VEC_MAX(a, vmax0);
+                    if (rms) vsum0 = VEC_ADD(vsum0, VEC_MUL(a, a));
+                }
+
+                VEC_STOREU(tmin + c, VEC_MIN(vmin1, vmin0));
+                VEC_STOREU(tmax + c, VEC_MAX(vmax1, vmax0));
+                if (rms) VEC_STOREU(tsum + c, VEC_ADD(vsum0, vsum1));
+            }
+        }
+
+        for (int c = 0; c < nblock; c++) {
+            peaks[c].mini = tmin[c];
+            peaks[c].maxi = tmax[c];
+            peaks[c].clipping = ANALYZE_CLIPPING(peaks[c]);
+            if (rms) {
+                peaks[c].sumsq += tsum[c];
+                peaks[c].count += nframes;
+            }
+        }
+    }
+
+    // the remaining channels are left to the next narrower kernel
+    if (nblock < nchannels) {
+        (rms ? ANALYZE_NARROW_RMS_FUNC : ANALYZE_NARROW_FUNC)
+            (frames + nblock, nframes, stride, nchannels - nblock, peaks + nblock);
+    }
+}
+
+
+static void ANALYZE_FUNC(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                         analyze_peak *peaks)
+{
+    ANALYZE_IMPL(frames, nframes, stride, nchannels, peaks, false);
+}
+
+
+static void ANALYZE_RMS_FUNC(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                             analyze_peak *peaks)
+{
+    ANALYZE_IMPL(frames, nframes, stride, nchannels, peaks, true);
+}
+
+
+// contiguous frames, nv vectors at a time, like ANALYZE_REPEAT(). lanes of the same
+// channel count into different copies of its histogram
+static inline __attribute__((always_inline))
+void HIST_REPEAT(sample_t const *frames, size_t n, int nchannels, const int nv, analyze_hist *hists)
+{
+    const int W = ANALYZE_WIDTH;
+    const int L = nv * W;
+
+    sample_t loff[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    sample_t lscale[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    sample_t ltop[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    unsigned int *lbins[ANALYZE_WIDTH * ANALYZE_MAX_REPEAT];
+    for (int l = 0; l < L; l++) {
+        analyze_hist *h = &hists[l % nchannels];
+        loff[l] = h->offset;
+        lscale[l] = h->scale;
+        ltop[l] = h->nbins - 1;
+        lbins[l] = h->bins + (l / nchannels % ANALYZE_HIST_COPIES) * h->nbins;
+    }
+
+    vec_t voff[ANALYZE_MAX_REPEAT], vscale[ANALYZE_MAX_REPEAT], vtop[ANALYZE_MAX_REPEAT];
+    for (int k = 0; k < nv; k++) {
+        voff[k] = VEC_LOADU(loff + k * W);
+        vscale[k] = VEC_LOADU(lscale + k * W);
+        vtop[k] = VEC_LOADU(ltop + k * W);
+    }
+    vec_t vzero = VEC_SET1(0.0f);
+
+    size_t i = 0;
+
+    for (; i + L <= n; i += L) {
+        for (int k = 0; k < nv; k++) {
+            vec_t y = VEC_SUB(voff[k], VEC_MUL(VEC_LOADU(frames + i + k * W), vscale[k]));
+            VEC_COUNT(VEC_INDEX(VEC_MIN(VEC_MAX(y, vzero), vtop[k])), lbins + k * W);
+        }
+    }
+    // fewer than nv vectors left, each still in its own lanes
+    for (int k = 0; k < nv && i + W <= n; k++, i += W) {
+        vec_t y = VEC_SUB(voff[k], VEC_MUL(VEC_LOADU(frames + i), vscale[k]));
+        VEC_COUNT(VEC_INDEX(VEC_MIN(VEC_MAX(y, vzero), vtop[k])), lbins + k * W);
+    }
+
+    for (; i < n; i++) {
+        int l = i % L;
+        sample_t y = loff[l] - frames[i] * lscale[l];
+        y = y > 0.0f ? y : 0.0f;
+        y = y < ltop[l] ? y : ltop[l];
+        lbins[l][(int)y]++;
+    }
+}
+
+
+// the row of every sample is computed for W samples at once, only the counting itself
+// is done one by one
+static void HIST_FUNC(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                      analyze_hist *hists)
+{
+    const int W = ANALYZE_WIDTH;
+
+    sample_t loff[ANALYZE_WIDTH], lscale[ANALYZE_WIDTH], ltop[ANALYZE_WIDTH];
+    vec_t vzero = VEC_SET1(0.0f);
+
+    if (stride == nchannels && (nchannels <= W || nchannels % W))
+    {
+        // the same steps as in ANALYZE_IMPL()
+        size_t n = (size_t)nframes * nchannels;
+        switch (nchannels / analyze_gcd(W, nchannels)) {
+            case 1: HIST_REPEAT(frames, n, nchannels, 1, hists); return;
+            case 2: HIST_REPEAT(frames, n, nchannels, 2, hists); return;
+            case 3: HIST_REPEAT(frames, n, nchannels, 3, hists); return;
+            case 4: HIST_REPEAT(frames, n, nchannels, 4, hists); return;
+            case 5: HIST_REPEAT(frames, n, nchannels, 5, hists); return;
+            case 6: HIST_REPEAT(frames, n, nchannels, 6, hists); return;
+            case 7: HIST_REPEAT(frames, n, nchannels, 7, hists); return;
+            case 8: HIST_REPEAT(frames, n, nchannels, 8, hists); return;
+            default: break;
+        }
+    }
+
+    // otherwise, process W adjacent channels at a time. consecutive frames count into
+    // different copies of the histograms
+    int nblock = nchannels - nchannels % W;
+
+    for (int c = 0; c < nblock; c += W)
+    {
+        unsigned int *lbins[ANALYZE_HIST_COPIES][ANALYZE_WIDTH];
+        for (int l = 0; l < W; l++) {
+            analyze_hist *h = &hists[c + l];
+            loff[l] = h->offset;
+            lscale[l] = h->scale;
+            ltop[l] = h->nbins - 1;
+            for (int k = 0; k < ANALYZE_HIST_COPIES; k++) {
+                lbins[k][l] = h->bins + k * h->nbins;
+            }
+        }
+
+        vec_t voff = VEC_LOADU(loff), vscale = VEC_LOADU(lscale), vtop = VEC_LOADU(ltop);
+        sample_t const *f = frames + c;
+
+        for (unsigned int i = 0; i < nframes; i++) {
+            vec_t y = VEC_SUB(voff, VEC_MUL(VEC_LOADU(f + (size_t)i * stride), vscale));
+            VEC_COUNT(VEC_INDEX(VEC_MIN(VEC_MAX(y, vzero), vtop)), lbins[i % ANALYZE_HIST_COPIES]);
+        }
+    }
+
+    if (nblock < nchannels) {
+        HIST_NARROW_FUNC(frames + nblock, nframes, stride, nchannels - nblock, hists + nblock);
+    }
+}
+
+
+// looks at W samples at once, but only the lanes of the trigger channel count.
+// the vectors are only looked at more closely if one of them crosses a level
+static unsigned int FIND_FUNC(sample_t const *frames, unsigned int nframes, int stride, int channel,
+                              analyze_trigger *trig)
+{
+    const int W = ANALYZE_WIDTH;
+
+    if (stride > W) {
+        // a vector would hold at most one sample of the channel
+        return analyze_find_trigger_scalar(frames, nframes, stride, channel, trig);
+    }
+
+    // as in the repeat path, the channel of each lane repeats every L = nv * W samples,
+    // so each of the nv vectors of that period gets its own mask of the channel's lanes
+    int nv = stride / analyze_gcd(W, stride);
+    unsigned int lanes[ANALYZE_WIDTH] = { 0 };
+    for (int l = channel; l < nv * W; l += stride) {
+        lanes[l / W] |= 1u << (l % W);
+    }
+
+    vec_t vsign = VEC_SET1(trig->sign), vlevel = VEC_SET1(trig->level), vrearm = VEC_SET1(trig->rearm);
+    bool armed = trig->armed;
+
+    size_t n = (size_t)nframes * stride;
+    size_t i = 0;
+
+    for (int v = 0; i + W <= n; i += W, v = v + 1 < nv ? v + 1 : 0) {
+        vec_t x = VEC_MUL(VEC_LOADU(frames + i), vsign);
+        unsigned int above = VEC_GE_MASK(x, vlevel) & lanes[v];
+
+        if (!armed) {
+            unsigned int below = VEC_LT_MASK(x, vrearm) & lanes[v];
+            if (!below) continue;
+            // armed after the first sample below, so only later ones may still trigger in this vector
+            above &= ~0u << __builtin_ctz(below) << 1;
+            armed = true;
+        }
+        if (above) {
+            trig->armed = false;
+            return (i + __builtin_ctz(above)) / stride;
+        }
+    }
+
+    trig->armed = armed;
+
+    // the rest starts with the first frame whose sample of the channel hasn't been looked at
+    unsigned int done = (i + stride - 1 - channel) / stride;
+    return done + analyze_find_trigger_scalar(frames + (size_t)done * stride, nframes - done, stride, channel,
+                                              trig);
+}
@@ -0,0 +1,399 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * long-term archive of everything that has been displayed, in a memory-mapped file.
+ * level 0 holds one entry per track for every ARCHIVE_FRAMES_PER_ENTRY frames,
+ * level n one entry for every ARCHIVE_LEVEL_FACTOR^n entries of level 0, so any
+ * stretch of time can be looked at with just a few entries per column.
+ *
+ * after the header, the file consists of chunks of ARCHIVE_CHUNK_ENTRIES entries,
+ * each belonging to one level. chunks are appended as they're needed, and only a
+ * handful of them are mapped at any time, so memory use doesn't grow with the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "main.h"
+#include "archive.h"
+#include "util.h"
+
+#define ARCHIVE_MAGIC               "JOSCARC1"
+#define ARCHIVE_LEVELS              10
+#define ARCHIVE_LEVEL_FACTOR        4
+#define ARCHIVE_FRAMES_PER_ENTRY    1024
+#define ARCHIVE_CHUNK_ENTRIES       16384
+// room for the header, a multiple of any common page size
+#define ARCHIVE_HEADER_SIZE         65536
+// number of chunks mapped for reading at the same time
+#define ARCHIVE_MAPS                16
+// samples are stored as 16 bit fixed point numbers, from -2 to almost +2
+#define ARCHIVE_SCALE               16384.0f
+
+
+// the lowest bit of mini is set if the track was clipping
+typedef struct {
+    int16_t mini;
+    int16_t maxi;
+} archive_entry;
+
+typedef struct {
+    char magic[8];
+    uint32_t nports;
+    uint32_t samplerate;
+    uint32_t frames_per_entry;
+    uint32_t level_factor;
+    uint32_t nlevels;
+    uint32_t chunk_entries;
+    int64_t start_time;                 // seconds since the epoch
+    uint64_t count[ARCHIVE_LEVELS];     // number of entries written to each level
+} archive_header;
+
+typedef struct {
+    int level;
+    uint64_t chunk;
+    archive_entry *entries;
+} archive_map;
+
+
+static void archive_exit();
+static void archive_close();
+
+static int fd = -1;
+static archive_header *header = NULL;
+static size_t chunk_size;
+static off_t file_size;
+
+// file offsets of the chunks of each level, in order
+static off_t *chunks[ARCHIVE_LEVELS];
+// the chunk of each level currently being written to
+static archive_entry *current[ARCHIVE_LEVELS];
+
+static archive_map maps[ARCHIVE_MAPS];
+static int next_map = 0;
+
+// entries of levels 1 and up that aren't complete yet, and the same for level 0,
+// which is filled with whatever number of frames each column stands for
+static analyze_peak *pending[ARCHIVE_LEVELS];
+static jack_nframes_t pending_frames = 0;
+
+
+void archive_init(char const *path)
+{
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, ARCHIVE_HEADER_SIZE) == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    header = (archive_header*)mmap(NULL, ARCHIVE_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(header->magic, ARCHIVE_MAGIC, sizeof(header->magic));
+    header->nports = g_nports;
+    header->samplerate = audio_get_samplerate();
+    header->frames_per_entry = ARCHIVE_FRAMES_PER_ENTRY;
+    header->level_factor = ARCHIVE_LEVEL_FACTOR;
+    header->nlevels = ARCHIVE_LEVELS;
+    header->chunk_entries = ARCHIVE_CHUNK_ENTRIES;
+    header->start_time = time(NULL);
+
+    chunk_size = (size_t)ARCHIVE_CHUNK_ENTRIES * g_nports * sizeof(archive_entry);
+    file_size = ARCHIVE_HEADER_SIZE;
+
+    for (int l = 0; l < ARCHIVE_LEVELS; l++) {
+        header->count[l] = 0;
+        chunks[l] = NULL;
+        current[l] = NULL;
+        pending[l] = (analyze_peak*)calloc(g_nports, sizeof(analyze_peak));
+        analyze_reset(pending[l], g_nports);
+    }
+
+    for (int n = 0; n < ARCHIVE_MAPS; n++) {
+        maps[n].entries = NULL;
+    }
+
+    atexit(archive_exit);
+}
+
+
+static void archive_exit()
+{
+    archive_close();
+
+    for (int l = 0; l < ARCHIVE_LEVELS; l++) {
+        free(chunks[l]);
+        free(pending[l]);
+    }
+}
+
+
+// unmaps everything and stops archiving. whatever has been written so far stays valid
+static void archive_close()
+{
+    if (fd == -1) {
+        return;
+    }
+
+    for (int l = 0; l < ARCHIVE_LEVELS; l++) {
+        if (current[l]) munmap(current[l], chunk_size);
+        current[l] = NULL;
+    }
+    for (int n = 0; n < ARCHIVE_MAPS; n++) {
+        if (maps[n].entries) munmap(maps[n].entries, chunk_size);
+        maps[n].entries = NULL;
+    }
+    munmap(header, ARCHIVE_HEADER_SIZE);
+    header = NULL;
+
+    close(fd);
+    fd = -1;
+}
+
+
+bool archive_is_open()
+{
+    return fd != -1;
+}
+
+
+static archive_entry * archive_map_chunk(off_t offset)
+{
+    void *p = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    return p == MAP_FAILED ? NULL : (archive_entry*)p;
+}
+
+
+// appends a new chunk to the given level, and makes it the one being written to
+static bool archive_add_chunk(int level)
+{
+    uint64_t nchunks = header->count[level] / ARCHIVE_CHUNK_ENTRIES;
+
+    // reserve the disk space right away. running out of it later, while writing
+    // to the mapped file, would crash the program
+    int err = posix_fallocate(fd, file_size, chunk_size);
+    if (err) {
+        fprintf(stderr, "can't extend archive: %s\n", strerror(err));
+        return false;
+    }
+
+    archive_entry *p = archive_map_chunk(file_size);
+    if (!p) {
+        perror("can't map archive");
+        return false;
+    }
+
+    chunks[level] = (off_t*)realloc(chunks[level], (nchunks + 1) * sizeof(off_t));
+    chunks[level][nchunks] = file_size;
+    file_size += chunk_size;
+
+    if (current[level]) munmap(current[level], chunk_size);
+    current[level] = p;
+    return true;
+}
+
+
+static inline int16_t archive_fixed(float f)
+{
+    return min(max(f, -32768.0f), 32767.0f);
+}
+
+
+static bool archive_push(int level, analyze_peak const *peaks)
+{
+    uint64_t index = header->count[level];
+
+    if (index % ARCHIVE_CHUNK_ENTRIES == 0 && !archive_add_chunk(level)) {
+        return false;
+    }
+
+    // rounded outwards, so the stored range always includes the actual one
+    archive_entry *e = current[level] + (index % ARCHIVE_CHUNK_ENTRIES) * g_nports;
+    for (int n = 0; n < g_nports; n++) {
+        e[n].mini = (archive_fixed(floorf(peaks[n].mini * ARCHIVE_SCALE)) & ~1) | peaks[n].clipping;
+        e[n].maxi = archive_fixed(ceilf(peaks[n].maxi * ARCHIVE_SCALE));
+    }
+
+    // the count is only updated once the entry is complete, for anyone reading the file meanwhile
+    header->count[level] = index + 1;
+
+    if (level + 1 < ARCHIVE_LEVELS) {
+        analyze_merge(pending[level + 1], peaks, g_nports);
+        if ((index + 1) % ARCHIVE_LEVEL_FACTOR == 0) {
+            bool ok = archive_push(level + 1, pending[level + 1]);
+            analyze_reset(pending[level + 1], g_nports);
+            return ok;
+        }
+    }
+
+    return true;
+}
+
+
+// adds a column standing for nframes frames of audio
+void archive_add(analyze_peak const *peaks, jack_nframes_t nframes)
+{
+    if (fd == -1) {
+        return;
+    }
+
+    // columns are rarely aligned with entries. a column spanning several entries
+    // is counted in each of them
+    while (nframes) {
+        jack_nframes_t n = min(nframes, ARCHIVE_FRAMES_PER_ENTRY - pending_frames);
+        analyze_merge(pending[0], peaks, g_nports);
+        pending_frames += n;
+        nframes -= n;
+
+        if (pending_frames == ARCHIVE_FRAMES_PER_ENTRY) {
+            if (!archive_push(0, pending[0])) {
+                fprintf(stderr, "archiving stopped\n");
+                archive_close();
+                return;
+            }
+            analyze_reset(pending[0], g_nports);
+            pending_frames = 0;
+        }
+    }
+}
+
+
+// number of frames covered by complete entries
+uint64_t archive_get_frames()
+{
+    return fd != -1 ? header->count[0] * ARCHIVE_FRAMES_PER_ENTRY : 0;
+}
+
+
+jack_nframes_t archive_get_resolution()
+{
+    return ARCHIVE_FRAMES_PER_ENTRY;
+}
+
+
+static inline uint64_t archive_entry_frames(int level)
+{
+    uint64_t f = ARCHIVE_FRAMES_PER_ENTRY;
+    while (level--) f *= ARCHIVE_LEVEL_FACTOR;
+    return f;
+}
+
+
+// returns the entries of the given chunk, mapping it if necessary
+static archive_entry const * archive_get_chunk(int level, uint64_t chunk)
+{
+    for (int n = 0; n < ARCHIVE_MAPS; n++) {
+        if (maps[n].entries && maps[n].level == level && maps[n].chunk == chunk) {
+            return maps[n].entries;
+        }
+    }
+
+    archive_entry *p = archive_map_chunk(chunks[level][chunk]);
+    if (!p) {
+        return NULL;
+    }
+
+    // replace the mappings in turn
+    archive_map *m = &maps[next_map];
+    next_map = (next_map + 1) % ARCHIVE_MAPS;
+    if (m->entries) munmap(m->entries, chunk_size);
+    m->level = level;
+    m->chunk = chunk;
+    m->entries = p;
+    return p;
+}
+
+
+// merges entries first to last - 1 of the given level into peaks
+static bool archive_merge(int level, uint64_t first, uint64_t last, analyze_peak *peaks)
+{
+    for (uint64_t i = first; i < last; )
+    {
+        uint64_t chunk = i / ARCHIVE_CHUNK_ENTRIES;
+        archive_entry const *e = archive_get_chunk(level, chunk);
+        if (!e) {
+            return false;
+        }
+
+        uint64_t end = min(last, (chunk + 1) * ARCHIVE_CHUNK_ENTRIES);
+        for (e += (i % ARCHIVE_CHUNK_ENTRIES) * g_nports; i < end; i++, e += g_nports) {
+            for (int n = 0; n < g_nports; n++) {
+                sample_t mini = (e[n].mini & ~1) / ARCHIVE_SCALE;
+                sample_t maxi = e[n].maxi / ARCHIVE_SCALE;
+                if (mini < peaks[n].mini) peaks[n].mini = mini;
+                if (maxi > peaks[n].maxi) peaks[n].maxi = maxi;
+                peaks[n].clipping |= e[n].mini & 1;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// summarizes nframes frames, starting at frame start since the archive was begun.
+// returns false if nothing of that has been archived
+bool archive_get(uint64_t start, uint64_t nframes, analyze_peak *peaks)
+{
+    if (fd == -1) {
+        return false;
+    }
+
+    // every entry of level 0 is counted where its first frame is, so that the summaries
+    // of adjacent ranges never share any entries
+    uint64_t first = (start + ARCHIVE_FRAMES_PER_ENTRY - 1) / ARCHIVE_FRAMES_PER_ENTRY;
+    uint64_t last = min((start + nframes + ARCHIVE_FRAMES_PER_ENTRY - 1) / ARCHIVE_FRAMES_PER_ENTRY,
+                        header->count[0]);
+    if (first >= last) {
+        return false;
+    }
+
+    analyze_reset(peaks, g_nports);
+
+    // those are covered by the coarsest entries that lie entirely within them, finer ones
+    // towards the edges. the newest part may not have made it into the coarser levels yet
+    for (uint64_t i = first; i < last; )
+    {
+        int level = 0;
+        uint64_t n = 1;
+        while (level + 1 < ARCHIVE_LEVELS) {
+            uint64_t m = n * ARCHIVE_LEVEL_FACTOR;
+            if (i % m || i + m > last || i / m >= header->count[level + 1]) break;
+            level++;
+            n = m;
+        }
+
+        // as many entries of this level as fit, but no further than to where
+        // the next coarser one could take over
+        uint64_t k = min((last - i) / n, header->count[level] - i / n);
+        if (level + 1 < ARCHIVE_LEVELS) {
+            k = min(k, (uint64_t)ARCHIVE_LEVEL_FACTOR - i / n % ARCHIVE_LEVEL_FACTOR);
+        }
+
+        if (!archive_merge(level, i / n, i / n + k, peaks)) {
+            return false;
+        }
+        i += k * n;
+    }
+
+    return true;
+}
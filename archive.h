@@ -0,0 +1,30 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio.h"
+#include "analyze.h"
+
+void archive_init(char const *path);
+bool archive_is_open();
+
+void archive_add(analyze_peak const *peaks, jack_nframes_t nframes);
+
+uint64_t archive_get_frames();
+jack_nframes_t archive_get_resolution();
+bool archive_get(uint64_t start, uint64_t nframes, analyze_peak *peaks);
+
+#endif // _ARCHIVE_H
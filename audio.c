@@ -9,73 +9,142 @@
  * (at your option) any later version.
  */
 
-#include <jack/jack.h>
 #include <jack/ringbuffer.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "main.h"
 #include "audio.h"
+#include "analyze.h"
 #include "waves.h"
+#include "stats.h"
 #include "util.h"
 
 #define SAMPLES_PER_PIXEL_MULTI     2
 #define SAMPLES_PER_FRAME_MULTI     8
 #define MIN_BUFFER_FRAMES           4096
+#define MIN_BUFFER_COLUMNS          1024
+#define THREAD_PERIOD_FRAMES        256
 
 
-static jack_client_t *client = NULL;
-static jack_port_t **input_ports = NULL;
+static const audio_backend *backend = NULL;
+static bool backend_open = false;
 
 static jack_nframes_t samplerate;
 
 static int buffer_frames = 0;
-static jack_ringbuffer_t **buffers = NULL;
+static size_t frame_size;
+static jack_ringbuffer_t *buffer = NULL;
+
+// frame time just past the newest frame in the buffer. buffer_seq is odd while the writer
+// is advancing the buffer and updating the time, so the reader can get both consistently
+static jack_nframes_t buffer_time = 0;
+static unsigned int buffer_seq = 0;
+
+// with g_prereduce or g_analysis_thread, only finished columns are passed to the GUI thread.
+// each column is followed by the frame time of its last sample
+static int buffer_columns = 0;
+static size_t peaks_size;
+static size_t column_size;
+static jack_ringbuffer_t *peak_buffer = NULL;
+static analyze_peak *reduce_peaks = NULL;
+static jack_nframes_t reduce_frames = 1;
+static jack_nframes_t reduce_count = 0;
+
+// the buffer audio_write() is currently using. audio_adjust() waits for it to be released
+// before freeing a buffer it has replaced, so nothing is ever allocated or freed by the writer
+static void *hazard = NULL;
+
+// periods lost because the buffer was full
+static unsigned long dropped = 0;
+
+// for backends without a clock of their own, frame time is counted from here
+static int64_t clock_start;
+
+// used by backends that generate audio in a thread of their own
+static pthread_t thread;
+static bool thread_running = false;
+static bool thread_finished = false;
+static jack_nframes_t (*thread_generate)(sample_t * const *, jack_nframes_t);
 
 static void audio_exit();
-static int audio_process(jack_nframes_t, void *);
 
 
-void audio_init(const char *name, const char * const * connect_ports)
+void audio_init(const char *name, const char *source, const char * const * connect_ports)
 {
-    if ((client = jack_client_open(name, (jack_options_t)0, NULL)) == 0) {
-        fprintf(stderr, "can't connect to jack server\n");
-        exit(EXIT_FAILURE);
-    }
-    jack_set_process_callback(client, &audio_process, NULL);
+    const char *arg = NULL;
 
-    atexit(audio_exit);
+    // source is either just the backend name, or "backend:argument"
+    if (!source) source = "jack";
 
-    if (jack_activate(client)) {
-        fprintf(stderr, "can't activate client\n");
+    static const audio_backend * const backends[] = {
+        &audio_backend_jack, &audio_backend_file, &audio_backend_raw, &audio_backend_synth
+    };
+
+    for (size_t n = 0; n < sizeof(backends) / sizeof(backends[0]); n++) {
+        size_t len = strlen(backends[n]->name);
+        if (strncmp(source, backends[n]->name, len) == 0 && (source[len] == '\0' || source[len] == ':')) {
+            backend = backends[n];
+            arg = source[len] ? source + len + 1 : NULL;
+        }
+    }
+    if (!backend) {
+        fprintf(stderr, "unknown audio source: %s\n", source);
         exit(EXIT_FAILURE);
     }
 
-    input_ports = (jack_port_t**)calloc(g_nports, sizeof(jack_port_t*));
-    buffers = (jack_ringbuffer_t**)calloc(g_nports, sizeof(jack_ringbuffer_t*));
+    // one frame holds one sample of every port
+    frame_size = g_nports * sizeof(sample_t);
 
-    for (int n = 0; n < g_nports; n++)
-    {
-        char port_name[8];
-        snprintf(port_name, 8, "in_%d", n + 1);
-        if ((input_ports[n] = jack_port_register(client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0)) == NULL) {
-            fprintf(stderr, "can't register input port\n");
-            exit(EXIT_FAILURE);
-        }
-        if (*connect_ports != NULL) {
-            if (jack_connect(client, *connect_ports, jack_port_name(input_ports[n]))) {
-                fprintf(stderr, "can't connect '%s' to '%s'\n", *connect_ports, jack_port_name(input_ports[n]));
-            }
-            connect_ports++;
-        }
+    peaks_size = g_nports * sizeof(analyze_peak);
+    column_size = peaks_size + sizeof(jack_nframes_t);
+
+    if (g_prereduce) {
+        reduce_peaks = (analyze_peak*)calloc(g_nports, sizeof(analyze_peak));
+        analyze_reset(reduce_peaks, g_nports);
     }
 
-    samplerate = jack_get_sample_rate(client);
+    clock_start = stats_now();
+
+    atexit(audio_exit);
+
+    backend->open(name, arg, connect_ports);
+    backend_open = true;
+
+    samplerate = backend->get_samplerate();
 
     audio_adjust();
 }
 
 
+// starts the audio source. called once g_run is set, otherwise the first periods would be dropped
+void audio_start()
+{
+    if (backend->start) {
+        backend->start();
+    }
+}
+
+
+// replaces one of the buffers, while audio_write() may be running in another thread
+static void audio_replace(jack_ringbuffer_t **ring, jack_ringbuffer_t *rb)
+{
+    jack_ringbuffer_t *old = __atomic_exchange_n(ring, rb, __ATOMIC_SEQ_CST);
+
+    // the writer may have picked up the old buffer just before the exchange
+    while (old && __atomic_load_n(&hazard, __ATOMIC_SEQ_CST) == old) {
+        usleep(100);
+    }
+    if (old) {
+        jack_ringbuffer_free(old);
+    }
+}
+
+
 void audio_adjust()
 {
     int n = next_power_of_two(max3(
@@ -84,41 +153,68 @@ void audio_adjust()
                 MIN_BUFFER_FRAMES
             ));
 
+    if (g_trigger_port >= 0) {
+        // room for a whole sweep, and for the search for the next trigger meanwhile
+        n = next_power_of_two(max(n, max(waves_samples_per_pixel(), 1) * g_width * 2));
+    }
+
     //printf("buffer_frames = %d\n", n);
 
-    if (buffer_frames != n)
+    if (g_prereduce || g_analysis_thread)
+    {
+        // the same amount of audio, but only one peak per track and column
+        jack_nframes_t frames = max(waves_samples_per_pixel(), 1);
+        __atomic_store_n(&reduce_frames, frames, __ATOMIC_RELAXED);
+        int c = next_power_of_two(max(n / (int)frames, MIN_BUFFER_COLUMNS));
+
+        if (buffer_columns != c)
+        {
+            buffer_columns = c;
+            audio_replace(&peak_buffer, jack_ringbuffer_create(buffer_columns * column_size));
+        }
+    }
+
+    if (!g_prereduce && buffer_frames != n)
     {
         buffer_frames = n;
+        audio_replace(&buffer, jack_ringbuffer_create(buffer_frames * frame_size));
+    }
+}
 
-        for (int n = 0; n < g_nports; n++) {
-            if (buffers[n]) {
-                jack_ringbuffer_free(buffers[n]);
-            }
-            buffers[n] = jack_ringbuffer_create(buffer_frames * sizeof(sample_t));
-        }
+
+// stops the audio source, so that nothing is written to the buffers anymore, and nothing
+// else that's about to be shut down is called from the audio callbacks
+void audio_stop()
+{
+    if (__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&thread_running, false, __ATOMIC_RELEASE);
+        pthread_join(thread, NULL);
+    }
+
+    if (backend_open) {
+        backend->close();
+        backend_open = false;
     }
 }
 
 
 static void audio_exit()
 {
-    if (client) {
-        jack_deactivate(client);
-        jack_client_close(client);
+    audio_stop();
+
+    free(reduce_peaks);
+    if (buffer) {
+        jack_ringbuffer_free(buffer);
     }
-    free(input_ports);
-    if (buffers) {
-        for (int n = 0; n < g_nports; n++) {
-            jack_ringbuffer_free(buffers[n]);
-        }
-        free(buffers);
+    if (peak_buffer) {
+        jack_ringbuffer_free(peak_buffer);
     }
 }
 
 
 const char * audio_get_client_name()
 {
-    return jack_get_client_name(client);
+    return backend->get_client_name();
 }
 
 
@@ -128,43 +224,304 @@ jack_nframes_t audio_get_samplerate()
 }
 
 
-static int audio_process(jack_nframes_t nframes, void *p)
+// how many frames into its current period the audio source is
+bool audio_get_cycle_position(jack_nframes_t *position, jack_nframes_t *period)
+{
+    if (!backend || !backend->get_cycle_position) {
+        return false;
+    }
+    return backend->get_cycle_position(position, period);
+}
+
+
+// whether the audio source has come to an end, e.g. the end of a file.
+// everything it has produced has been written to the buffer by then
+bool audio_is_finished()
+{
+    return __atomic_load_n(&thread_finished, __ATOMIC_ACQUIRE);
+}
+
+
+// the current time in frames. wraps around, so only differences are meaningful
+jack_nframes_t audio_get_frame_time()
+{
+    if (backend->get_frame_time) {
+        return backend->get_frame_time();
+    }
+    return (jack_nframes_t)(uint64_t)((stats_now() - clock_start) * 1e-9 * samplerate);
+}
+
+
+static void audio_reduce(jack_ringbuffer_t *rb, jack_nframes_t frames, sample_t * const *ports,
+                         jack_nframes_t nframes, jack_nframes_t time)
+{
+    jack_nframes_t offset = 0;
+
+    // fold the period into the running peaks, and pass on every column as soon as it's complete
+    while (offset < nframes)
+    {
+        jack_nframes_t n = reduce_count < frames ? min(nframes - offset, frames - reduce_count) : 0;
+
+        for (int p = 0; p < g_nports; p++) {
+            analyze_frames(ports[p] + offset, n, 1, 1, &reduce_peaks[p]);
+        }
+        offset += n;
+        reduce_count += n;
+
+        if (reduce_count >= frames) {
+            jack_nframes_t stamp = time + offset - 1;
+            jack_ringbuffer_write(rb, (const char*)reduce_peaks, peaks_size);
+            jack_ringbuffer_write(rb, (const char*)&stamp, sizeof(stamp));
+            analyze_reset(reduce_peaks, g_nports);
+            reduce_count = 0;
+        }
+    }
+}
+
+
+// gets the current buffer, and keeps audio_adjust() from freeing it until it's released again
+static jack_ringbuffer_t * audio_acquire(jack_ringbuffer_t **ring)
+{
+    jack_ringbuffer_t *rb;
+
+    do {
+        rb = __atomic_load_n(ring, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&hazard, rb, __ATOMIC_SEQ_CST);
+    } while (rb != __atomic_load_n(ring, __ATOMIC_SEQ_CST));
+
+    return rb;
+}
+
+
+static void audio_release()
+{
+    __atomic_store_n(&hazard, NULL, __ATOMIC_RELEASE);
+}
+
+
+static bool audio_write_peaks(jack_ringbuffer_t *rb, sample_t * const *ports, jack_nframes_t nframes, jack_nframes_t time)
+{
+    // make sure there's room for every column this period is going to complete
+    jack_nframes_t frames = __atomic_load_n(&reduce_frames, __ATOMIC_RELAXED);
+    size_t columns = (min(reduce_count, frames) + nframes) / frames;
+    if (jack_ringbuffer_write_space(rb) < columns * column_size) {
+        return false;
+    }
+    audio_reduce(rb, frames, ports, nframes, time);
+    return true;
+}
+
+
+static bool audio_write_frames(jack_ringbuffer_t *rb, sample_t * const *ports, jack_nframes_t nframes, jack_nframes_t time)
+{
+    size_t size = nframes * frame_size;
+    if (jack_ringbuffer_write_space(rb) < size) {
+        return false;
+    }
+
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(rb, vec);
+
+    // interleave samples, continuing at the start of the buffer when reaching the end
+    // of the first segment (which may well happen in the middle of a frame)
+    sample_t *dst = (sample_t*)vec[0].buf;
+    sample_t *end = dst + vec[0].len / sizeof(sample_t);
+
+    for (jack_nframes_t i = 0; i < nframes; i++) {
+        for (int n = 0; n < g_nports; n++) {
+            if (dst == end) dst = (sample_t*)vec[1].buf;
+            *dst++ = ports[n][i];
+        }
+    }
+
+    __atomic_store_n(&buffer_seq, buffer_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    jack_ringbuffer_write_advance(rb, size);
+    __atomic_store_n(&buffer_time, time + nframes, __ATOMIC_RELAXED);
+    __atomic_store_n(&buffer_seq, buffer_seq + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+static bool audio_try_write(sample_t * const *ports, jack_nframes_t nframes, jack_nframes_t time)
+{
+    if (!g_run) return false;
+
+    int64_t t = stats_now();
+
+    // a period is either written for all ports at once, or dropped entirely.
+    // this way the ports can never get out of sync
+    bool written;
+
+    if (g_prereduce) {
+        written = audio_write_peaks(audio_acquire(&peak_buffer), ports, nframes, time);
+        audio_release();
+    } else {
+        written = audio_write_frames(audio_acquire(&buffer), ports, nframes, time);
+        audio_release();
+
+        if (written) {
+            waves_wakeup();
+        }
+    }
+
+    stats_add(STATS_PROCESS, stats_now() - t);
+
+    return written;
+}
+
+
+// time is the frame time of the period's first frame
+bool audio_write(sample_t * const *ports, jack_nframes_t nframes, jack_nframes_t time)
+{
+    if (audio_try_write(ports, nframes, time)) {
+        return true;
+    }
+    if (g_run) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    }
+    return false;
+}
+
+
+unsigned long audio_get_dropped()
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+
+// how full the buffer the audio is written to is, from 0 to 1.
+// only to be called from the same thread as audio_adjust()
+float audio_get_fill()
+{
+    jack_ringbuffer_t *rb = g_prereduce ? peak_buffer : buffer;
+    if (!rb) return 0.0f;
+    return (float)jack_ringbuffer_read_space(rb) / (rb->size - 1);
+}
+
+
+static void * audio_thread(void *p)
 {
     (void)p;
 
-    static bool buffer_full = false;
+    sample_t **ports = (sample_t**)calloc(g_nports, sizeof(sample_t*));
+    for (int n = 0; n < g_nports; n++) {
+        ports[n] = (sample_t*)calloc(THREAD_PERIOD_FRAMES, sizeof(sample_t));
+    }
 
-    if (!g_run) return 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
 
-    for (int n = 0; n < g_nports; n++)
+    while (__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE))
     {
-        void *in = jack_port_get_buffer(input_ports[n], nframes);
-        if (jack_ringbuffer_write_space(buffers[n]) >= (nframes * sizeof(sample_t))) {
-            jack_ringbuffer_write(buffers[n], (const char*)in, (nframes * sizeof(sample_t)));
-            buffer_full = false;
+        jack_nframes_t nframes = thread_generate(ports, THREAD_PERIOD_FRAMES);
+        if (!nframes) break;
+
+        if (g_speed > 0.0f) {
+            // real time, or some multiple thereof. like JACK, drop the period if the buffer is full
+            audio_write(ports, nframes, audio_get_frame_time() - nframes);
+
+            long ns = (long)(nframes * 1e9 / (samplerate * g_speed));
+            next.tv_nsec += ns;
+            while (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
         } else {
-            // this shouldn't be here...
-            //if (!buffer_full) fprintf(stderr, "insufficient buffer space\n");
-            buffer_full = true;
-            break;
+            // as fast as possible, so wait until there's enough room
+            while (!audio_try_write(ports, nframes, audio_get_frame_time() - nframes) &&
+                   __atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+                usleep(1000);
+            }
         }
     }
-    return 0;
+
+    for (int n = 0; n < g_nports; n++) {
+        free(ports[n]);
+    }
+    free(ports);
+
+    __atomic_store_n(&thread_finished, true, __ATOMIC_RELEASE);
+
+    return NULL;
 }
 
 
-jack_nframes_t audio_buffer_get_available()
+void audio_start_thread(jack_nframes_t (*generate)(sample_t * const *, jack_nframes_t))
 {
-    size_t minimum = SIZE_MAX;
-    for (int n = 0; n < g_nports; n++) {
-        size_t av = jack_ringbuffer_read_space(buffers[n]);
-        if (av < minimum) minimum = av;
+    thread_generate = generate;
+    __atomic_store_n(&thread_running, true, __ATOMIC_RELEASE);
+
+    if (pthread_create(&thread, NULL, audio_thread, NULL)) {
+        fprintf(stderr, "can't create audio thread\n");
+        exit(EXIT_FAILURE);
     }
-    return minimum / sizeof(sample_t);
 }
 
 
-void audio_buffer_read(int nport, sample_t *frames, jack_nframes_t nframes)
+jack_nframes_t audio_buffer_get_available()
+{
+    return jack_ringbuffer_read_space(buffer) / frame_size;
+}
+
+
+void audio_buffer_get_read_vector(jack_ringbuffer_data_t *vec)
+{
+    jack_ringbuffer_get_read_vector(buffer, vec);
+}
+
+
+void audio_buffer_read_advance(jack_nframes_t nframes)
+{
+    jack_ringbuffer_read_advance(buffer, nframes * frame_size);
+}
+
+
+// the frame time of the next frame to be read
+jack_nframes_t audio_buffer_get_time()
+{
+    unsigned int seq;
+    jack_nframes_t time, available;
+
+    // try again if a period was written in the meantime, otherwise its frames might
+    // be counted as available, but not in the time yet
+    do {
+        seq = __atomic_load_n(&buffer_seq, __ATOMIC_ACQUIRE);
+        time = __atomic_load_n(&buffer_time, __ATOMIC_RELAXED);
+        available = audio_buffer_get_available();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&buffer_seq, __ATOMIC_RELAXED));
+
+    return time - available;
+}
+
+
+jack_nframes_t audio_peaks_get_available()
+{
+    return jack_ringbuffer_read_space(peak_buffer) / column_size;
+}
+
+
+// returns the frame time of the column's last sample
+jack_nframes_t audio_peaks_read(analyze_peak *peaks)
+{
+    jack_nframes_t time;
+    jack_ringbuffer_read(peak_buffer, (char*)peaks, peaks_size);
+    jack_ringbuffer_read(peak_buffer, (char*)&time, sizeof(time));
+    return time;
+}
+
+
+jack_nframes_t audio_peaks_get_write_space()
+{
+    return jack_ringbuffer_write_space(peak_buffer) / column_size;
+}
+
+
+void audio_peaks_write(struct analyze_peak const *peaks, jack_nframes_t time)
 {
-    jack_ringbuffer_read(buffers[nport], (char*)frames, nframes * sizeof(sample_t));
+    jack_ringbuffer_write(peak_buffer, (const char*)peaks, peaks_size);
+    jack_ringbuffer_write(peak_buffer, (const char*)&time, sizeof(time));
 }
@@ -12,18 +12,61 @@
 #ifndef _AUDIO_H
 #define _AUDIO_H
 
+#include <stdbool.h>
 #include <jack/types.h>
 #include <jack/ringbuffer.h>
 
 typedef jack_default_audio_sample_t sample_t;
 
-void audio_init(const char *name, const char * const * connect_ports);
+struct analyze_peak;
+
+// a source of audio data. open() exits the program if anything goes wrong.
+// start() may be NULL if the backend doesn't need to be started separately.
+// get_cycle_position() may be NULL if the backend doesn't process audio in periods.
+// get_frame_time() may be NULL if the backend has no clock of its own, the system clock is used then
+typedef struct {
+    const char *name;
+    void (*open)(const char *name, const char *arg, const char * const * connect_ports);
+    void (*start)();
+    void (*close)();
+    const char * (*get_client_name)();
+    jack_nframes_t (*get_samplerate)();
+    bool (*get_cycle_position)(jack_nframes_t *position, jack_nframes_t *period);
+    jack_nframes_t (*get_frame_time)();
+} audio_backend;
+
+extern const audio_backend audio_backend_jack;
+extern const audio_backend audio_backend_file;
+extern const audio_backend audio_backend_raw;
+extern const audio_backend audio_backend_synth;
+
+void audio_init(const char *name, const char *source, const char * const * connect_ports);
+void audio_start();
+void audio_stop();
 void audio_adjust();
 
 const char * audio_get_client_name();
 jack_nframes_t audio_get_samplerate();
+bool audio_get_cycle_position(jack_nframes_t *position, jack_nframes_t *period);
+jack_nframes_t audio_get_frame_time();
+bool audio_is_finished();
+unsigned long audio_get_dropped();
+float audio_get_fill();
+
+// for use by the backends
+bool audio_write(sample_t * const *ports, jack_nframes_t nframes, jack_nframes_t time);
+void audio_start_thread(jack_nframes_t (*generate)(sample_t * const *ports, jack_nframes_t nframes));
 
 jack_nframes_t audio_buffer_get_available();
-void audio_buffer_read(int nport, sample_t *frames, jack_nframes_t nframes);
+void audio_buffer_get_read_vector(jack_ringbuffer_data_t *vec);
+void audio_buffer_read_advance(jack_nframes_t nframes);
+jack_nframes_t audio_buffer_get_time();
+
+jack_nframes_t audio_peaks_get_available();
+jack_nframes_t audio_peaks_read(struct analyze_peak *peaks);
+
+// for use by the analysis thread
+jack_nframes_t audio_peaks_get_write_space();
+void audio_peaks_write(struct analyze_peak const *peaks, jack_nframes_t time);
 
 #endif // _AUDIO_H
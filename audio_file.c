@@ -0,0 +1,273 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * plays back audio from a WAV file, or from a file containing raw interleaved
+ * 32-bit floats. if the file has fewer channels than there are ports, the
+ * channels are repeated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <libgen.h>
+
+#include "main.h"
+#include "audio.h"
+#include "util.h"
+
+#define DEFAULT_SAMPLERATE  48000
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xfffe
+
+
+static FILE *file = NULL;
+static char client_name[256];
+
+static jack_nframes_t samplerate;
+static int channels;
+static int format;
+static int bytes_per_sample;
+static uint64_t frames_left;
+
+static unsigned char *file_buffer = NULL;
+
+
+static inline uint32_t read_le(const unsigned char *p, int n)
+{
+    uint32_t v = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+
+static void audio_file_fail(const char *path, const char *msg)
+{
+    fprintf(stderr, "can't read '%s': %s\n", path, msg);
+    exit(EXIT_FAILURE);
+}
+
+
+static void audio_file_open_file(const char *path)
+{
+    if (!(file = fopen(path, "rb"))) {
+        audio_file_fail(path, "can't open file");
+    }
+
+    // basename() may modify its argument
+    char *p = strdup(path);
+    snprintf(client_name, sizeof(client_name), "%s", basename(p));
+    free(p);
+}
+
+
+static void audio_file_open_wav(const char *name, const char *arg, const char * const * connect_ports)
+{
+    (void)name;
+    (void)connect_ports;
+
+    if (!arg) {
+        fprintf(stderr, "no file name given\n");
+        exit(EXIT_FAILURE);
+    }
+    audio_file_open_file(arg);
+
+    unsigned char header[12];
+    if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+        audio_file_fail(arg, "not a WAV file");
+    }
+
+    bool have_fmt = false;
+
+    // walk through the chunks until we find the data
+    for (;;)
+    {
+        unsigned char chunk[8];
+        if (fread(chunk, 1, 8, file) != 8) {
+            audio_file_fail(arg, "no data chunk");
+        }
+        uint32_t size = read_le(chunk + 4, 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0)
+        {
+            unsigned char fmt[40] = { 0 };
+            if (size < 16 || fread(fmt, 1, min(size, (uint32_t)sizeof(fmt)), file) != min(size, (uint32_t)sizeof(fmt))) {
+                audio_file_fail(arg, "invalid format chunk");
+            }
+            format = read_le(fmt, 2);
+            channels = read_le(fmt + 2, 2);
+            samplerate = read_le(fmt + 4, 4);
+            bytes_per_sample = read_le(fmt + 14, 2) / 8;
+            if (format == WAVE_FORMAT_EXTENSIBLE && size >= 26) {
+                // the actual format is at the start of the subformat GUID
+                format = read_le(fmt + 24, 2);
+            }
+            if (size > sizeof(fmt)) {
+                fseek(file, size - sizeof(fmt), SEEK_CUR);
+            }
+            have_fmt = true;
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            if (!have_fmt) {
+                audio_file_fail(arg, "no format chunk");
+            }
+            if (!((format == WAVE_FORMAT_PCM && bytes_per_sample >= 1 && bytes_per_sample <= 4) ||
+                  (format == WAVE_FORMAT_IEEE_FLOAT && bytes_per_sample == 4)) || !channels || !samplerate) {
+                audio_file_fail(arg, "unsupported sample format");
+            }
+            frames_left = size / (channels * bytes_per_sample);
+            break;
+        }
+        else
+        {
+            fseek(file, size + (size & 1), SEEK_CUR);
+        }
+    }
+}
+
+
+static void audio_file_open_raw(const char *name, const char *arg, const char * const * connect_ports)
+{
+    (void)name;
+    (void)connect_ports;
+
+    if (!arg) {
+        fprintf(stderr, "no file name given\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // "path[,samplerate]". a comma that isn't followed by digits only is part of the path
+    char *path = strdup(arg);
+    char *rate = strrchr(path, ',');
+    if (rate && rate[1] && strspn(rate + 1, "0123456789") == strlen(rate + 1)) {
+        *rate++ = '\0';
+    } else {
+        rate = NULL;
+    }
+
+    audio_file_open_file(path);
+
+    format = WAVE_FORMAT_IEEE_FLOAT;
+    bytes_per_sample = 4;
+    channels = g_nports;
+    samplerate = DEFAULT_SAMPLERATE;
+    if (rate) {
+        long r = strtol(rate, NULL, 10);
+        if (r <= 0 || r > INT_MAX) {
+            fprintf(stderr, "invalid samplerate: %s\n", rate);
+            exit(EXIT_FAILURE);
+        }
+        samplerate = r;
+    }
+    frames_left = UINT64_MAX;
+
+    free(path);
+}
+
+
+static inline sample_t audio_file_convert(const unsigned char *p)
+{
+    if (format == WAVE_FORMAT_IEEE_FLOAT) {
+        union { uint32_t i; float f; } u = { read_le(p, 4) };
+        return u.f;
+    }
+
+    switch (bytes_per_sample) {
+        case 1:
+            return (p[0] - 128) / 128.0f;
+        case 2:
+            return (int16_t)read_le(p, 2) / 32768.0f;
+        case 3:
+            return ((int32_t)(read_le(p, 3) << 8) >> 8) / 8388608.0f;
+        default:
+            return (int32_t)read_le(p, 4) / 2147483648.0f;
+    }
+}
+
+
+static jack_nframes_t audio_file_generate(sample_t * const *ports, jack_nframes_t nframes)
+{
+    size_t frame_bytes = channels * bytes_per_sample;
+
+    if (!file_buffer) {
+        file_buffer = (unsigned char*)malloc(nframes * frame_bytes);
+    }
+
+    nframes = min((uint64_t)nframes, frames_left);
+    nframes = fread(file_buffer, frame_bytes, nframes, file);
+    frames_left -= nframes;
+
+    for (jack_nframes_t i = 0; i < nframes; i++) {
+        const unsigned char *f = file_buffer + i * frame_bytes;
+        for (int n = 0; n < g_nports; n++) {
+            ports[n][i] = audio_file_convert(f + (n % channels) * bytes_per_sample);
+        }
+    }
+
+    return nframes;
+}
+
+
+static void audio_file_start()
+{
+    audio_start_thread(audio_file_generate);
+}
+
+
+static void audio_file_close()
+{
+    if (file) {
+        fclose(file);
+    }
+    free(file_buffer);
+}
+
+
+static const char * audio_file_get_client_name()
+{
+    return client_name;
+}
+
+
+static jack_nframes_t audio_file_get_samplerate()
+{
+    return samplerate;
+}
+
+
+const audio_backend audio_backend_file = {
+    "file",
+    audio_file_open_wav,
+    audio_file_start,
+    audio_file_close,
+    audio_file_get_client_name,
+    audio_file_get_samplerate,
+    NULL,
+    NULL
+};
+
+const audio_backend audio_backend_raw = {
+    "raw",
+    audio_file_open_raw,
+    audio_file_start,
+    audio_file_close,
+    audio_file_get_client_name,
+    audio_file_get_samplerate,
+    NULL,
+    NULL
+};
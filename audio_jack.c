@@ -0,0 +1,139 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <jack/jack.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "audio.h"
+
+
+static jack_client_t *client = NULL;
+static jack_port_t **input_ports = NULL;
+static sample_t **port_buffers = NULL;
+
+// start and length of the most recent process cycle, in one word so they can be read atomically
+static uint64_t last_cycle = 0;
+
+
+static int audio_jack_process(jack_nframes_t nframes, void *p)
+{
+    (void)p;
+
+    jack_nframes_t time = jack_last_frame_time(client);
+    __atomic_store_n(&last_cycle, (uint64_t)time << 32 | nframes, __ATOMIC_RELAXED);
+
+    if (!g_run) return 0;
+
+    for (int n = 0; n < g_nports; n++) {
+        port_buffers[n] = (sample_t*)jack_port_get_buffer(input_ports[n], nframes);
+    }
+
+    audio_write(port_buffers, nframes, time);
+
+    return 0;
+}
+
+
+static void audio_jack_open(const char *name, const char *arg, const char * const * connect_ports)
+{
+    (void)arg;
+
+    if ((client = jack_client_open(name, (jack_options_t)0, NULL)) == 0) {
+        fprintf(stderr, "can't connect to jack server\n");
+        exit(EXIT_FAILURE);
+    }
+    jack_set_process_callback(client, &audio_jack_process, NULL);
+
+    input_ports = (jack_port_t**)calloc(g_nports, sizeof(jack_port_t*));
+    port_buffers = (sample_t**)calloc(g_nports, sizeof(sample_t*));
+
+    if (jack_activate(client)) {
+        fprintf(stderr, "can't activate client\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int n = 0; n < g_nports; n++)
+    {
+        char port_name[8];
+        snprintf(port_name, 8, "in_%d", n + 1);
+        if ((input_ports[n] = jack_port_register(client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0)) == NULL) {
+            fprintf(stderr, "can't register input port\n");
+            exit(EXIT_FAILURE);
+        }
+        if (*connect_ports != NULL) {
+            if (jack_connect(client, *connect_ports, jack_port_name(input_ports[n]))) {
+                fprintf(stderr, "can't connect '%s' to '%s'\n", *connect_ports, jack_port_name(input_ports[n]));
+            }
+            connect_ports++;
+        }
+    }
+}
+
+
+static void audio_jack_close()
+{
+    if (client) {
+        jack_deactivate(client);
+        jack_client_close(client);
+    }
+    free(input_ports);
+    free(port_buffers);
+}
+
+
+static const char * audio_jack_get_client_name()
+{
+    return jack_get_client_name(client);
+}
+
+
+static jack_nframes_t audio_jack_get_samplerate()
+{
+    return jack_get_sample_rate(client);
+}
+
+
+static bool audio_jack_get_cycle_position(jack_nframes_t *position, jack_nframes_t *period)
+{
+    uint64_t cycle = __atomic_load_n(&last_cycle, __ATOMIC_RELAXED);
+    jack_nframes_t start = cycle >> 32;
+    *period = cycle & 0xffffffff;
+
+    if (*period == 0) {
+        // no cycle has run yet
+        return false;
+    }
+
+    // jack_frame_time() is safe to call from any thread, and estimates the current time in frames
+    *position = (jack_frame_time(client) - start) % *period;
+    return true;
+}
+
+
+static jack_nframes_t audio_jack_get_frame_time()
+{
+    return jack_frame_time(client);
+}
+
+
+const audio_backend audio_backend_jack = {
+    "jack",
+    audio_jack_open,
+    NULL,
+    audio_jack_close,
+    audio_jack_get_client_name,
+    audio_jack_get_samplerate,
+    audio_jack_get_cycle_position,
+    audio_jack_get_frame_time
+};
@@ -0,0 +1,153 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * generates test signals, with a different frequency/phase on every port.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "audio.h"
+
+#define DEFAULT_SAMPLERATE  48000
+#define BASE_FREQUENCY      110.0
+
+
+typedef enum {
+    SIGNAL_SINE,
+    SIGNAL_NOISE,
+    SIGNAL_CLIP
+} synth_signal;
+
+static synth_signal signal_type = SIGNAL_SINE;
+static jack_nframes_t samplerate = DEFAULT_SAMPLERATE;
+static char client_name[64];
+
+// sine oscillators, using the recurrence s[n+1] = 2 cos(w) s[n] - s[n-1]
+static double *osc_coeff = NULL;
+static double *osc_state = NULL;
+static unsigned int seed = 1;
+
+
+static void audio_synth_open(const char *name, const char *arg, const char * const * connect_ports)
+{
+    (void)name;
+    (void)connect_ports;
+
+    // "[signal][,samplerate]"
+    char *s = strdup(arg ? arg : "");
+    char *rate = strchr(s, ',');
+    if (rate) *rate++ = '\0';
+
+    if (!*s || strcmp(s, "sine") == 0) {
+        signal_type = SIGNAL_SINE;
+    } else if (strcmp(s, "noise") == 0) {
+        signal_type = SIGNAL_NOISE;
+    } else if (strcmp(s, "clip") == 0) {
+        signal_type = SIGNAL_CLIP;
+    } else {
+        fprintf(stderr, "unknown signal: %s\n", s);
+        exit(EXIT_FAILURE);
+    }
+    if (rate) samplerate = atoi(rate);
+    if (!samplerate) {
+        fprintf(stderr, "invalid samplerate\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(client_name, sizeof(client_name), "synth: %s", *s ? s : "sine");
+    free(s);
+
+    osc_coeff = (double*)calloc(g_nports, sizeof(double));
+    osc_state = (double*)calloc(2 * g_nports, sizeof(double));
+
+    for (int n = 0; n < g_nports; n++) {
+        double w = 2.0 * M_PI * BASE_FREQUENCY * (n + 1) / samplerate;
+        osc_coeff[n] = 2.0 * cos(w);
+        osc_state[2 * n] = 0.0;
+        osc_state[2 * n + 1] = -sin(w);
+    }
+}
+
+
+static jack_nframes_t audio_synth_generate(sample_t * const *ports, jack_nframes_t nframes)
+{
+    for (int n = 0; n < g_nports; n++)
+    {
+        sample_t *p = ports[n];
+
+        if (signal_type == SIGNAL_NOISE) {
+            for (jack_nframes_t i = 0; i < nframes; i++) {
+                seed = seed * 1103515245 + 12345;
+                p[i] = 0.9f * ((float)(seed >> 8) / (1 << 23) - 1.0f);
+            }
+        } else {
+            // overdrive the sine wave for clipping
+            double amplitude = signal_type == SIGNAL_CLIP ? 1.2 : 0.8;
+            double c = osc_coeff[n];
+            double s0 = osc_state[2 * n];
+            double s1 = osc_state[2 * n + 1];
+
+            for (jack_nframes_t i = 0; i < nframes; i++) {
+                double s = c * s0 - s1;
+                s1 = s0;
+                s0 = s;
+                p[i] = amplitude * s;
+            }
+
+            osc_state[2 * n] = s0;
+            osc_state[2 * n + 1] = s1;
+        }
+    }
+
+    return nframes;
+}
+
+
+static void audio_synth_start()
+{
+    audio_start_thread(audio_synth_generate);
+}
+
+
+static void audio_synth_close()
+{
+    free(osc_coeff);
+    free(osc_state);
+}
+
+
+static const char * audio_synth_get_client_name()
+{
+    return client_name;
+}
+
+
+static jack_nframes_t audio_synth_get_samplerate()
+{
+    return samplerate;
+}
+
+
+const audio_backend audio_backend_synth = {
+    "synth",
+    audio_synth_open,
+    audio_synth_start,
+    audio_synth_close,
+    audio_synth_get_client_name,
+    audio_synth_get_samplerate,
+    NULL,
+    NULL
+};
@@ -0,0 +1,541 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * microbenchmarks for the analysis and drawing code.
+ * runs without JACK, and without a display (using SDL's dummy video driver).
+ * results are written as CSV, one line per measurement.
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#include "main.h"
+#include "video.h"
+#include "audio.h"
+#include "analyze.h"
+#include "waves.h"
+#include "util.h"
+
+#define BENCH_SAMPLERATE    48000
+#define BENCH_WIDTH         800
+#define BENCH_MAX_SAMPLES   (4 << 20)
+#define BENCH_WORKERS       4
+
+
+// the globals that are otherwise defined in main.c
+bool    g_run = false;
+int     g_nports = 1;
+
+float   g_fps = DEFAULT_FPS;
+bool    g_phase_lock = false;
+bool    g_scrolling = true;
+int     g_width = BENCH_WIDTH;
+int     g_height = 0;
+int     g_total_height;
+bool    g_use_gl = false;
+bool    g_use_vbo = false;
+bool    g_prereduce = false;
+float   g_max_latency = 0.0f;
+char const *g_headless = NULL;
+bool    g_analysis_thread = false;
+int     g_analysis_cpu = -1;
+int     g_analysis_priority = 0;
+int     g_nworkers = 1;
+
+float   g_duration = DEFAULT_DURATION;
+bool    g_show_clipping = true;
+bool    g_density = false;
+bool    g_show_rms = false;
+
+int     g_trigger_port = -1;
+float   g_trigger_level = 0.0f;
+bool    g_trigger_falling = false;
+float   g_trigger_hysteresis = DEFAULT_TRIGGER_HYSTERESIS;
+float   g_trigger_holdoff = 0.0f;
+
+Uint32  *g_colors = NULL;
+float   *g_scales = NULL;
+int     *g_heights = NULL;
+
+
+static FILE *output = NULL;
+static double min_time = 0.1;
+// set if a vectorized version didn't give the same results as the scalar one
+static bool failed = false;
+
+static const char * const signals[] = { "sine", "noise", "clip" };
+static const char * const impls[] = { "scalar", "sse2", "avx2", "avx512" };
+
+#define NELEMS(a) (int)(sizeof(a) / sizeof((a)[0]))
+
+
+// stand-ins for the functions in audio.c, serving prepared data instead of audio from JACK
+static sample_t *bench_frames = NULL;
+static jack_nframes_t bench_frames_len, bench_frames_pos;
+static analyze_peak *bench_peaks = NULL;
+static jack_nframes_t bench_peaks_len, bench_peaks_pos;
+
+jack_nframes_t audio_get_samplerate()
+{
+    return BENCH_SAMPLERATE;
+}
+
+bool audio_get_cycle_position(jack_nframes_t *position, jack_nframes_t *period)
+{
+    (void)position;
+    (void)period;
+    return false;
+}
+
+unsigned long audio_get_dropped()
+{
+    return 0;
+}
+
+float audio_get_fill()
+{
+    return 0.0f;
+}
+
+jack_nframes_t audio_get_frame_time()
+{
+    return bench_frames_pos;
+}
+
+bool audio_is_finished()
+{
+    return false;
+}
+
+jack_nframes_t audio_buffer_get_available()
+{
+    return bench_frames_len - bench_frames_pos;
+}
+
+void audio_buffer_get_read_vector(jack_ringbuffer_data_t *vec)
+{
+    vec[0].buf = (char*)(bench_frames + bench_frames_pos * g_nports);
+    vec[0].len = (bench_frames_len - bench_frames_pos) * g_nports * sizeof(sample_t);
+    vec[1].buf = NULL;
+    vec[1].len = 0;
+}
+
+void audio_buffer_read_advance(jack_nframes_t nframes)
+{
+    bench_frames_pos += nframes;
+}
+
+jack_nframes_t audio_buffer_get_time()
+{
+    return bench_frames_pos;
+}
+
+jack_nframes_t audio_peaks_get_available()
+{
+    return bench_peaks_len - bench_peaks_pos;
+}
+
+jack_nframes_t audio_peaks_read(analyze_peak *peaks)
+{
+    memcpy(peaks, bench_peaks + bench_peaks_pos * g_nports, g_nports * sizeof(analyze_peak));
+    return bench_peaks_pos++;
+}
+
+jack_nframes_t audio_peaks_get_write_space()
+{
+    return 0;
+}
+
+void audio_peaks_write(analyze_peak const *peaks, jack_nframes_t time)
+{
+    (void)peaks;
+    (void)time;
+}
+
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void bench_signal(const char *signal, sample_t *frames, jack_nframes_t nframes, int nports)
+{
+    unsigned int seed = 12345;
+
+    for (jack_nframes_t i = 0; i < nframes; i++) {
+        for (int n = 0; n < nports; n++) {
+            sample_t s;
+            if (strcmp(signal, "sine") == 0) {
+                s = 0.8f * sinf(2.0f * M_PI * 440.0f * i / BENCH_SAMPLERATE + n);
+            } else if (strcmp(signal, "noise") == 0) {
+                seed = seed * 1103515245 + 12345;
+                s = 0.9f * ((float)(seed >> 8) / (1 << 23) - 1.0f);
+            } else {
+                // overdriven square wave, clipping all the time
+                s = ((i + n * 17) / 50) % 2 ? 1.2f : -1.2f;
+            }
+            frames[(size_t)i * nports + n] = s;
+        }
+    }
+}
+
+
+static void bench_report(const char *test, const char *impl, const char *signal, int nports,
+                         jack_nframes_t frames_per_line, int height, long columns, double t)
+{
+    double ns_per_sample = frames_per_line ? t * 1e9 / ((double)columns * frames_per_line * nports) : 0.0;
+
+    fprintf(output, "%s,%s,%s,%d,%u,%d,%d,%.4f,%.1f\n", test, impl, signal, nports, frames_per_line,
+            g_width, height, ns_per_sample, columns / t);
+    fflush(output);
+
+    fprintf(stderr, "%-8s %-7s %-6s ports=%-3d frames=%-5u height=%-5d %8.3f ns/sample %12.1f columns/s\n",
+            test, impl, signal, nports, frames_per_line, height, ns_per_sample, columns / t);
+}
+
+
+// with rms, the kernels also summing up the squares are measured, for comparison with those that don't
+static void bench_analyze(const char *impl, const char *signal, int nports, jack_nframes_t frames_per_line, bool rms)
+{
+    int ncolumns = max(BENCH_MAX_SAMPLES / (int)(nports * frames_per_line), 1);
+    size_t column_samples = (size_t)frames_per_line * nports;
+
+    sample_t *frames = (sample_t*)malloc(ncolumns * column_samples * sizeof(sample_t));
+    analyze_peak *peaks = (analyze_peak*)malloc(nports * sizeof(analyze_peak));
+    bench_signal(signal, frames, ncolumns * frames_per_line, nports);
+    analyze_set_rms(rms);
+
+    long columns = 0;
+    double t, t0 = bench_now();
+
+    do {
+        for (int c = 0; c < ncolumns; c++) {
+            analyze_reset(peaks, nports);
+            analyze_frames(frames + c * column_samples, frames_per_line, nports, nports, peaks);
+        }
+        columns += ncolumns;
+    } while ((t = bench_now() - t0) < min_time);
+
+    bench_report(rms ? "analyze-rms" : "analyze", impl, signal, nports, frames_per_line, 0, columns, t);
+
+    analyze_set_rms(false);
+    free(frames);
+    free(peaks);
+}
+
+
+static void bench_histogram(const char *impl, const char *signal, int nports, jack_nframes_t frames_per_line,
+                            int height)
+{
+    int ncolumns = max(BENCH_MAX_SAMPLES / (int)(nports * frames_per_line), 1);
+    size_t column_samples = (size_t)frames_per_line * nports;
+
+    sample_t *frames = (sample_t*)malloc(ncolumns * column_samples * sizeof(sample_t));
+    analyze_hist *hists = (analyze_hist*)malloc(nports * sizeof(analyze_hist));
+    unsigned int *bins = (unsigned int*)malloc(nports * ANALYZE_HIST_COPIES * height * sizeof(unsigned int));
+    bench_signal(signal, frames, ncolumns * frames_per_line, nports);
+
+    for (int n = 0; n < nports; n++) {
+        hists[n].nbins = height;
+        hists[n].offset = hists[n].scale = height / 2.0f;
+        hists[n].bins = bins + n * ANALYZE_HIST_COPIES * height;
+    }
+
+    long columns = 0;
+    double t, t0 = bench_now();
+
+    do {
+        for (int c = 0; c < ncolumns; c++) {
+            analyze_hist_reset(hists, nports);
+            analyze_histogram(frames + c * column_samples, frames_per_line, nports, nports, hists);
+        }
+        columns += ncolumns;
+    } while ((t = bench_now() - t0) < min_time);
+
+    bench_report("histogram", impl, signal, nports, frames_per_line, height, columns, t);
+
+    free(frames);
+    free(hists);
+    free(bins);
+}
+
+
+// all the rising edges on one port, as a single hash of their positions
+static unsigned long bench_trigger_edges(sample_t const *frames, jack_nframes_t nframes, int nports, int channel)
+{
+    analyze_trigger trig;
+    analyze_trigger_init(&trig, 0.5f, false, DEFAULT_TRIGGER_HYSTERESIS);
+
+    unsigned long hash = 0;
+    for (jack_nframes_t i = 0; i < nframes; i++) {
+        i += analyze_find_trigger(frames + (size_t)i * nports, nframes - i, nports, channel, &trig);
+        hash = hash * 31 + i;
+    }
+    return hash;
+}
+
+
+// searches the first port for rising edges, going on right after each one found
+static void bench_trigger(const char *impl, const char *signal, int nports, jack_nframes_t frames_per_line)
+{
+    int ncolumns = max(BENCH_MAX_SAMPLES / (int)(nports * frames_per_line), 1);
+    size_t column_samples = (size_t)frames_per_line * nports;
+
+    sample_t *frames = (sample_t*)malloc(ncolumns * column_samples * sizeof(sample_t));
+    bench_signal(signal, frames, ncolumns * frames_per_line, nports);
+
+    // the vectorized searches must find the same edges as the scalar one, on every port
+    // and whether or not the port count divides the vector width
+    if (strcmp(impl, "scalar") != 0 && frames_per_line == 1024) {
+        for (int c = 0; c < nports; c++) {
+            analyze_select("scalar");
+            unsigned long expected = bench_trigger_edges(frames, ncolumns * frames_per_line, nports, c);
+            analyze_select(impl);
+            if (bench_trigger_edges(frames, ncolumns * frames_per_line, nports, c) != expected) {
+                fprintf(stderr, "%s: trigger search differs from scalar (%s, %d ports, port %d)\n",
+                        impl, signal, nports, c);
+                failed = true;
+            }
+        }
+    }
+
+    analyze_trigger trig;
+    analyze_trigger_init(&trig, 0.5f, false, DEFAULT_TRIGGER_HYSTERESIS);
+
+    long columns = 0;
+    double t, t0 = bench_now();
+
+    do {
+        for (int c = 0; c < ncolumns; c++) {
+            sample_t const *f = frames + c * column_samples;
+            for (jack_nframes_t i = 0; i < frames_per_line; i++) {
+                i += analyze_find_trigger(f + i * nports, frames_per_line - i, nports, 0, &trig);
+            }
+        }
+        columns += ncolumns;
+    } while ((t = bench_now() - t0) < min_time);
+
+    bench_report("trigger", impl, signal, nports, frames_per_line, 0, columns, t);
+
+    free(frames);
+}
+
+
+static void bench_draw_child(const char *test, const char *signal, int nports,
+                             jack_nframes_t frames_per_line, int height)
+{
+    g_nports = nports;
+    g_height = height;
+    g_duration = (float)frames_per_line * g_width / BENCH_SAMPLERATE;
+    // "draw" measures drawing only, "column" includes the analysis, "density" the histograms too,
+    // and "rms" the sums of squares and the rms bands
+    g_prereduce = strcmp(test, "draw") == 0;
+    g_density = strcmp(test, "density") == 0;
+    g_show_rms = strcmp(test, "rms") == 0;
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        fprintf(stderr, "can't init SDL: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    atexit(SDL_Quit);
+
+    analyze_init();
+    analyze_set_rms(g_show_rms);
+    video_init();
+    waves_init();
+
+    int ncolumns = min(max(BENCH_MAX_SAMPLES / (int)(nports * frames_per_line), 1), g_width);
+    size_t column_samples = (size_t)frames_per_line * nports;
+
+    bench_frames_len = ncolumns * frames_per_line;
+    bench_frames = (sample_t*)malloc(ncolumns * column_samples * sizeof(sample_t));
+    bench_signal(signal, bench_frames, bench_frames_len, nports);
+
+    bench_peaks_len = ncolumns;
+    bench_peaks = (analyze_peak*)malloc(ncolumns * nports * sizeof(analyze_peak));
+    for (int c = 0; c < ncolumns; c++) {
+        analyze_peak *p = bench_peaks + c * nports;
+        analyze_reset(p, nports);
+        analyze_frames(bench_frames + c * column_samples, frames_per_line, nports, nports, p);
+    }
+
+    g_run = true;
+
+    long columns = 0;
+    double t, t0 = bench_now();
+
+    do {
+        bench_frames_pos = bench_peaks_pos = 0;
+        waves_draw();
+        columns += ncolumns;
+    } while ((t = bench_now() - t0) < min_time);
+
+    // with several workers, e.g. "sdl/4"
+    char impl[16];
+    snprintf(impl, sizeof(impl), g_nworkers > 1 && !g_prereduce ? "%s/%d" : "%s",
+             g_use_gl ? (g_use_vbo ? "gl-lines" : "gl") : "sdl", g_nworkers);
+
+    bench_report(test, impl, signal, nports, g_prereduce ? 0 : frames_per_line, g_height, columns, t);
+
+    free(bench_frames);
+    free(bench_peaks);
+}
+
+
+static void bench_draw(const char *test, const char *signal, int nports,
+                       jack_nframes_t frames_per_line, int height)
+{
+    // every configuration runs in its own process, so that it starts from scratch
+    fflush(output);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        bench_draw_child(test, signal, nports, frames_per_line, height);
+        exit(EXIT_SUCCESS);
+    } else if (pid > 0) {
+        int status;
+        waitpid(pid, &status, 0);
+    } else {
+        perror("fork");
+    }
+}
+
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage:\n"
+            "  jack_oscrolloscope_bench [options]\n"
+            "\n"
+            "Options:\n"
+            "  -o <file>        write results to file instead of stdout\n"
+            "  -t <seconds>     minimum duration of each measurement (default 0.1)\n"
+            "  -g               use OpenGL for drawing (needs a display)\n"
+            "  -v               with -g, draw lines from a vertex buffer instead of textures\n"
+            "  -w <number>      number of threads analyzing the ports in the column test (default 1,\n"
+            "                   plus a run with 4)\n"
+            "  -h               show this help\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    output = stdout;
+
+    while ((c = getopt(argc, argv, "o:t:gvw:h")) != -1)
+    {
+        switch (c) {
+            case 'o':
+                if (!(output = fopen(optarg, "w"))) {
+                    perror(optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                min_time = atof(optarg);
+                break;
+            case 'g':
+                g_use_gl = true;
+                break;
+            case 'v':
+                g_use_vbo = true;
+                break;
+            case 'w':
+                g_nworkers = max(atoi(optarg), 1);
+                break;
+            case 'h':
+                print_usage();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    if (!g_use_gl) {
+        setenv("SDL_VIDEODRIVER", "dummy", 1);
+    }
+
+    fprintf(output, "test,impl,signal,ports,frames_per_line,width,height,ns_per_sample,columns_per_sec\n");
+
+    // channel counts that do and don't divide the vector widths
+    static const int analyze_ports[] = { 1, 2, 3, 6, 8, 12, 24, 64 };
+    static const jack_nframes_t analyze_frames_per_line[] = { 64, 1024, 4096 };
+
+    analyze_init();
+
+    for (int i = 0; i < NELEMS(impls); i++) {
+        if (!analyze_select(impls[i])) continue;
+        for (int s = 0; s < NELEMS(signals); s++) {
+            for (int p = 0; p < NELEMS(analyze_ports); p++) {
+                for (int f = 0; f < NELEMS(analyze_frames_per_line); f++) {
+                    bench_analyze(impls[i], signals[s], analyze_ports[p], analyze_frames_per_line[f], false);
+                    bench_analyze(impls[i], signals[s], analyze_ports[p], analyze_frames_per_line[f], true);
+                    bench_histogram(impls[i], signals[s], analyze_ports[p], analyze_frames_per_line[f], 120);
+                    bench_trigger(impls[i], signals[s], analyze_ports[p], analyze_frames_per_line[f]);
+                }
+            }
+        }
+    }
+
+    static const int draw_ports[] = { 1, 8, 64 };
+    static const int draw_heights[] = { 120, 480, 1080 };
+    static const jack_nframes_t draw_frames_per_line[] = { 64, 1024 };
+
+    for (int s = 0; s < NELEMS(signals); s++) {
+        for (int p = 0; p < NELEMS(draw_ports); p++) {
+            for (int h = 0; h < NELEMS(draw_heights); h++) {
+                bench_draw("draw", signals[s], draw_ports[p], 1024, draw_heights[h]);
+            }
+        }
+    }
+
+    for (int p = 0; p < NELEMS(draw_ports); p++) {
+        for (int f = 0; f < NELEMS(draw_frames_per_line); f++) {
+            bench_draw("column", "sine", draw_ports[p], draw_frames_per_line[f], 480);
+            bench_draw("density", "sine", draw_ports[p], draw_frames_per_line[f], 480);
+            bench_draw("rms", "sine", draw_ports[p], draw_frames_per_line[f], 480);
+        }
+    }
+
+    // the column test is also run with several workers, unless -w asked for that anyway
+    if (g_nworkers == 1) {
+        static const int worker_ports[] = { 24, 64 };
+
+        g_nworkers = BENCH_WORKERS;
+        for (int p = 0; p < NELEMS(worker_ports); p++) {
+            for (int f = 0; f < NELEMS(draw_frames_per_line); f++) {
+                bench_draw("column", "sine", worker_ports[p], draw_frames_per_line[f], 480);
+            }
+        }
+        g_nworkers = 1;
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,24 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _FONT_H
+#define _FONT_H
+
+#include <SDL.h>
+
+#define FONT_WIDTH      5
+#define FONT_HEIGHT     7
+
+// returns FONT_HEIGHT rows of the given character, top to bottom.
+// bit FONT_WIDTH - 1 of each row is the leftmost pixel
+Uint8 const * font_get_glyph(char c);
+
+#endif // _FONT_H
@@ -0,0 +1,247 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * output of the frames rendered without a window: either every frame as raw RGBA
+ * to stdout, or a PNG snapshot every so many seconds of audio.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "main.h"
+#include "headless.h"
+#include "util.h"
+
+#define HEADLESS_AMASK              (~(Uint32)(HEADLESS_RMASK | HEADLESS_GMASK | HEADLESS_BMASK))
+#define DEFAULT_SNAPSHOT_INTERVAL   60.0f
+// the largest block of uncompressed data a deflate stream can hold
+#define DEFLATE_BLOCK_SIZE          65535
+
+
+static void headless_exit();
+
+static FILE *raw = NULL;
+static char *prefix = NULL;
+static float interval = DEFAULT_SNAPSHOT_INTERVAL;
+
+static long frames = 0;
+static long snapshots = 0;
+static long snapshot_frame = 0;
+
+static Uint8 *data = NULL;
+static size_t data_size = 0;
+
+static uint32_t crc_table[256];
+
+
+void headless_init(const char *output)
+{
+    if (strcmp(output, "-") == 0) {
+        raw = stdout;
+    } else {
+        // "prefix[,seconds]"
+        prefix = strdup(output);
+        char *p = strchr(prefix, ',');
+        if (p) {
+            *p++ = '\0';
+            interval = atof(p);
+            if (interval <= 0.0f) {
+                fprintf(stderr, "invalid snapshot interval: %s\n", p);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    // a pipe closed by the reader is reported like any other write error
+    signal(SIGPIPE, SIG_IGN);
+
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+
+    atexit(headless_exit);
+}
+
+
+static void headless_exit()
+{
+    free(prefix);
+    free(data);
+}
+
+
+// makes sure the data buffer holds at least size bytes
+static void headless_reserve(size_t size)
+{
+    if (data_size < size) {
+        data_size = size;
+        data = (Uint8*)realloc(data, data_size);
+    }
+}
+
+
+static void headless_write_raw(SDL_Surface *surface)
+{
+    size_t size = surface->w * 4;
+    headless_reserve(size);
+
+    // the unused byte of every pixel becomes an opaque alpha value
+    for (int y = 0; y < surface->h; y++) {
+        Uint32 const *src = (Uint32 const *)((Uint8 const *)surface->pixels + y * surface->pitch);
+        Uint32 *dst = (Uint32*)data;
+        for (int x = 0; x < surface->w; x++) {
+            dst[x] = src[x] | HEADLESS_AMASK;
+        }
+        if (fwrite(data, size, 1, raw) != 1) {
+            fprintf(stderr, "can't write frame: %s\n", strerror(errno));
+            g_run = false;
+            return;
+        }
+    }
+    fflush(raw);
+}
+
+
+static uint32_t headless_crc(uint32_t crc, Uint8 const *p, size_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+static inline void headless_put_be32(Uint8 *p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+
+static void headless_write_chunk(FILE *f, char const *type, Uint8 const *p, size_t len)
+{
+    Uint8 header[8], crc[4];
+    headless_put_be32(header, len);
+    memcpy(header + 4, type, 4);
+    headless_put_be32(crc, headless_crc(headless_crc(0, header + 4, 4), p, len));
+
+    fwrite(header, 8, 1, f);
+    fwrite(p, len, 1, f);
+    fwrite(crc, 4, 1, f);
+}
+
+
+// writes the surface as an RGB PNG. the image data is stored without compression,
+// which keeps this simple and fast, and doesn't need zlib
+static bool headless_write_png(SDL_Surface *surface, char const *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    int w = surface->w, h = surface->h;
+    size_t row_size = 1 + 3 * w;
+    size_t image_size = row_size * h;
+    size_t nblocks = max((image_size + DEFLATE_BLOCK_SIZE - 1) / DEFLATE_BLOCK_SIZE, (size_t)1);
+    size_t stream_size = 2 + image_size + 5 * nblocks + 4;
+
+    // the image is put together right behind the room for the zlib header,
+    // then moved apart block by block to make room for the block headers
+    headless_reserve(stream_size);
+    Uint8 *image = data + stream_size - 4 - image_size;
+
+    for (int y = 0; y < h; y++) {
+        Uint8 const *src = (Uint8 const *)surface->pixels + y * surface->pitch;
+        Uint8 *dst = image + y * row_size;
+        *dst++ = 0;     // no filter
+        // the pixels are stored as red, green, blue and one unused byte, regardless of byte order
+        for (int x = 0; x < w; x++, src += 4) {
+            *dst++ = src[0];
+            *dst++ = src[1];
+            *dst++ = src[2];
+        }
+    }
+
+    // adler-32 checksum of the uncompressed data
+    uint32_t a = 1, b = 0;
+    for (size_t n = 0; n < image_size; n++) {
+        a += image[n];
+        if (a >= 65521) a -= 65521;
+        b += a;
+        if (b >= 65521) b -= 65521;
+    }
+
+    Uint8 *p = data;
+    *p++ = 0x78;    // deflate, 32K window
+    *p++ = 0x01;    // no preset dictionary, fastest
+
+    for (size_t k = 0; k < nblocks; k++) {
+        size_t offset = k * DEFLATE_BLOCK_SIZE;
+        size_t len = min(image_size - offset, (size_t)DEFLATE_BLOCK_SIZE);
+        *p++ = k == nblocks - 1;    // last block?
+        *p++ = len; *p++ = len >> 8;
+        *p++ = ~len; *p++ = ~len >> 8;
+        memmove(p, image + offset, len);
+        p += len;
+    }
+    headless_put_be32(p, b << 16 | a);
+
+    Uint8 ihdr[13];
+    headless_put_be32(ihdr, w);
+    headless_put_be32(ihdr + 4, h);
+    ihdr[8] = 8;        // bits per channel
+    ihdr[9] = 2;        // RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    fwrite("\x89PNG\r\n\x1a\n", 8, 1, f);
+    headless_write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    headless_write_chunk(f, "IDAT", data, stream_size);
+    headless_write_chunk(f, "IEND", NULL, 0);
+
+    bool ok = !ferror(f);
+    if (fclose(f) || !ok) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+
+void headless_write_frame(SDL_Surface *surface)
+{
+    frames++;
+
+    if (raw) {
+        headless_write_raw(surface);
+        return;
+    }
+
+    // one snapshot at the end of every interval, and one of whatever is left at the end
+    if (frames / g_fps >= (snapshots + 1) * interval || (!g_run && frames > snapshot_frame)) {
+        snapshot_frame = frames;
+        char path[strlen(prefix) + 16];
+        snprintf(path, sizeof(path), "%s-%06ld.png", prefix, snapshots++);
+        if (!headless_write_png(surface, path)) {
+            g_run = false;
+        }
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _HEADLESS_H
+#define _HEADLESS_H
+
+#include <SDL.h>
+
+// the surface rendered to instead of a window must use this pixel format,
+// so every pixel is stored as red, green, blue and one unused byte
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define HEADLESS_RMASK  0x000000ff
+#define HEADLESS_GMASK  0x0000ff00
+#define HEADLESS_BMASK  0x00ff0000
+#else
+#define HEADLESS_RMASK  0xff000000
+#define HEADLESS_GMASK  0x00ff0000
+#define HEADLESS_BMASK  0x0000ff00
+#endif
+
+void headless_init(const char *output);
+void headless_write_frame(SDL_Surface *surface);
+
+#endif // _HEADLESS_H
@@ -0,0 +1,187 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * keeps the peaks of recently drawn columns, at several resolutions: level n
+ * contains one entry for every 2^n columns. this way, the display can be
+ * redrawn immediately after the window size or the duration has changed,
+ * without having to wait for new audio data.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "main.h"
+#include "history.h"
+#include "util.h"
+
+#define HISTORY_LEVELS  8
+
+
+typedef struct {
+    analyze_peak *entries;
+    int head;                   // where the next entry will be written
+    int count;                  // number of valid entries
+} history_level;
+
+
+static void history_exit();
+
+static history_level levels[HISTORY_LEVELS];
+static analyze_peak *pending[HISTORY_LEVELS];   // incomplete entries of levels 1 and up
+static int size = 0;                            // number of entries per level
+static jack_nframes_t frames_per_entry = 0;     // resolution of level 0
+static unsigned long added = 0;
+
+
+void history_init()
+{
+    for (int l = 0; l < HISTORY_LEVELS; l++) {
+        levels[l].entries = NULL;
+        levels[l].head = levels[l].count = 0;
+        pending[l] = (analyze_peak*)calloc(g_nports, sizeof(analyze_peak));
+        analyze_reset(pending[l], g_nports);
+    }
+
+    atexit(history_exit);
+}
+
+
+static void history_exit()
+{
+    for (int l = 0; l < HISTORY_LEVELS; l++) {
+        free(levels[l].entries);
+        free(pending[l]);
+    }
+}
+
+
+static inline analyze_peak * history_entry(history_level *level, int age)
+{
+    return level->entries + ((level->head - 1 - age + size) % size) * g_nports;
+}
+
+
+static inline void history_push(history_level *level, analyze_peak const *peaks)
+{
+    analyze_peak *e = level->entries + level->head * g_nports;
+    for (int n = 0; n < g_nports; n++) {
+        e[n] = peaks[n];
+    }
+    level->head = (level->head + 1) % size;
+    if (level->count < size) level->count++;
+}
+
+
+void history_adjust(jack_nframes_t frames_per_line, int width)
+{
+    // enough entries on each level to zoom out by a factor of up to two
+    // without having to use the next coarser level
+    int new_size = 2 * width;
+    history_level new_levels[HISTORY_LEVELS];
+
+    // resample what we have to the new resolution
+    for (int l = 0; l < HISTORY_LEVELS; l++) {
+        new_levels[l].entries = (analyze_peak*)malloc(new_size * g_nports * sizeof(analyze_peak));
+        new_levels[l].count = history_get(frames_per_line << l, new_size, new_levels[l].entries);
+        new_levels[l].head = 0;
+    }
+
+    for (int l = 0; l < HISTORY_LEVELS; l++) {
+        free(levels[l].entries);
+        levels[l] = new_levels[l];
+        analyze_reset(pending[l], g_nports);
+    }
+
+    size = new_size;
+    frames_per_entry = frames_per_line;
+    added = 0;
+}
+
+
+void history_add(analyze_peak const *peaks)
+{
+    history_push(&levels[0], peaks);
+    added++;
+
+    for (int l = 1; l < HISTORY_LEVELS; l++) {
+        analyze_merge(pending[l], peaks, g_nports);
+        if (added % (1UL << l) == 0) {
+            history_push(&levels[l], pending[l]);
+            analyze_reset(pending[l], g_nports);
+        }
+    }
+}
+
+
+// the same as calling history_add() n times, e.g. for the columns that were skipped
+// and merged into one. only the newest entries of every level are kept anyway
+void history_add_repeated(analyze_peak const *peaks, unsigned long n)
+{
+    if (!n) return;
+
+    for (unsigned long i = 0; i < min(n, (unsigned long)size); i++) {
+        history_push(&levels[0], peaks);
+    }
+
+    for (int l = 1; l < HISTORY_LEVELS; l++) {
+        unsigned long complete = (added + n) / (1UL << l) - added / (1UL << l);
+
+        analyze_merge(pending[l], peaks, g_nports);
+        if (complete) {
+            history_push(&levels[l], pending[l]);
+            for (unsigned long i = 1; i < min(complete, (unsigned long)size + 1); i++) {
+                history_push(&levels[l], peaks);
+            }
+            analyze_reset(pending[l], g_nports);
+            if ((added + n) % (1UL << l)) {
+                analyze_merge(pending[l], peaks, g_nports);
+            }
+        }
+    }
+
+    added += n;
+}
+
+
+int history_get(jack_nframes_t frames_per_line, int ncolumns, analyze_peak *columns)
+{
+    if (!frames_per_entry) return 0;
+
+    // use the coarsest level that still has at least the requested resolution
+    int l = 0;
+    while (l + 1 < HISTORY_LEVELS && ((uint64_t)frames_per_entry << (l + 1)) <= frames_per_line) {
+        l++;
+    }
+    history_level *level = &levels[l];
+
+    // number of entries per column. less than one when zooming in
+    double ratio = (double)frames_per_line / ((double)frames_per_entry * (1 << l));
+
+    // fill in columns from the newest (last) to the oldest, until we run out of entries
+    int k;
+    for (k = 0; k < ncolumns; k++)
+    {
+        int first = (int)(k * ratio);
+        int last = max((int)ceil((k + 1) * ratio) - 1, first);
+        if (first >= level->count) break;
+        last = min(last, level->count - 1);
+
+        analyze_peak *c = columns + (ncolumns - 1 - k) * g_nports;
+        analyze_reset(c, g_nports);
+        for (int age = first; age <= last; age++) {
+            analyze_merge(c, history_entry(level, age), g_nports);
+        }
+    }
+
+    return k;
+}
@@ -0,0 +1,24 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include "audio.h"
+#include "analyze.h"
+
+void history_init();
+void history_adjust(jack_nframes_t frames_per_line, int width);
+void history_add(analyze_peak const *peaks);
+void history_add_repeated(analyze_peak const *peaks, unsigned long n);
+int history_get(jack_nframes_t frames_per_line, int ncolumns, analyze_peak *columns);
+
+#endif // _HISTORY_H
@@ -16,26 +16,50 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
+#include <signal.h>
+#include <math.h>
 
 #include "main.h"
 #include "video.h"
 #include "audio.h"
+#include "analyze.h"
 #include "waves.h"
+#include "stats.h"
+#include "headless.h"
+#include "archive.h"
 #include "util.h"
 
 
 bool    g_run = false;
 int     g_nports = 0;
 
-int     g_ticks_per_frame = 1000 / DEFAULT_FPS;
+float   g_fps = DEFAULT_FPS;
+bool    g_phase_lock = false;
 bool    g_scrolling = true;
 int     g_width = DEFAULT_WIDTH;
 int     g_height = 0;
 int     g_total_height;
 bool    g_use_gl = true;
+bool    g_use_vbo = false;
+bool    g_prereduce = false;
+bool    g_analysis_thread = false;
+int     g_analysis_cpu = -1;
+int     g_analysis_priority = 0;
+int     g_nworkers = 1;
+float   g_speed = 1.0f;
+float   g_max_latency = 0.0f;
+char const *g_headless = NULL;
 
 float   g_duration = DEFAULT_DURATION;
 bool    g_show_clipping = false;
+bool    g_density = false;
+bool    g_show_rms = false;
+
+int     g_trigger_port = -1;
+float   g_trigger_level = 0.0f;
+bool    g_trigger_falling = false;
+float   g_trigger_hysteresis = DEFAULT_TRIGGER_HYSTERESIS;
+float   g_trigger_holdoff = 0.0f;
 
 Uint32  *g_colors = NULL;
 float   *g_scales = NULL;
@@ -46,6 +70,9 @@ static int  nscales = 0;
 static int  nheights = 0;
 
 static char const * g_client_name = "jack_oscrolloscope";
+static char const * g_source = NULL;
+static char const * g_stats_file = NULL;
+static char const * g_archive_file = NULL;
 
 
 static void print_usage()
@@ -60,14 +87,34 @@ static void print_usage()
             "  -n <number>      number of input ports\n"
             "  -d <seconds>     duration of audio being displayed (default " STRINGIFY(DEFAULT_DURATION) "s)\n"
             "  -c               indicate clipping\n"
+            "  -i               draw waveforms with intensity grading, like an analog scope\n"
+            "  -r               show the RMS level inside each waveform\n"
             "  -s               disable scrolling\n"
+            "  -T <port>[,<level>[,+|-[,<hysteresis>[,<holdoff ms>]]]]\n"
+            "                   triggered mode: draw a sweep whenever the given port\n"
+            "                   crosses the level (default 0, rising edge)\n"
             "  -x <pixels>      set window width\n"
             "  -y <pixels>      set window height\n"
             "  -C <color,...>   set waveform color\n"
             "  -S <scale,...>   set waveform scale\n"
             "  -Y <height,...>  set waveform height (per port)\n"
             "  -G               don't use OpenGL for drawing\n"
+            "  -v               draw waveforms as lines from a vertex buffer (OpenGL only)\n"
+            "  -p               analyze audio in the JACK process callback\n"
+            "  -t               analyze audio in a separate thread\n"
+            "  -a <cpu>         run the analysis thread on the given CPU\n"
+            "  -P <priority>    realtime priority of the analysis thread (default 0 = none)\n"
+            "  -w <number>      number of threads sharing the analysis of all ports (default 1)\n"
+            "  -I <source>      audio source: jack (default), file:<wav file>,\n"
+            "                   raw:<float file>[,<rate>], synth:[sine|noise|clip][,<rate>]\n"
+            "  -R <speed>       playback speed of files and synth (default 1, 0 = unlimited)\n"
             "  -f <fps>         video frames per second (default " STRINGIFY(DEFAULT_FPS) ", 0 = unlimited/vsync)\n"
+            "  -J               show video frames in sync with JACK periods\n"
+            "  -l <ms>          maximum delay of the display, skipping audio if necessary\n"
+            "  -m <file>        write performance statistics to file every second (- = stdout)\n"
+            "  -H <output>      render without a window: raw RGBA frames to stdout (-),\n"
+            "                   or <prefix>[,<seconds>] for a PNG snapshot every 60 seconds\n"
+            "  -A <file>        keep everything displayed in an archive file, to be viewed with h\n"
             "  -h               show this help\n");
 }
 
@@ -97,19 +144,28 @@ static void parse_colors(char *s)
 
     g_colors = (Uint32*)realloc(g_colors, n * sizeof(Uint32));
 
-    // we'll need an X display for this... yuck!
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) {
-        fprintf(stderr, "can't open display\n");
-        exit(EXIT_FAILURE);
-    }
-    Colormap cmap = DefaultColormap(dpy, 0);
+    Display *dpy = NULL;
+    Colormap cmap = 0;
 
     // tokenize the string and parse each color
     char *p = strsep(&s, ",");
     while (p) {
         Uint32 c;
-        if (strlen(p) || !ncolors) {
+        unsigned int rgb;
+        int len;
+        if (sscanf(p, "#%6x%n", &rgb, &len) == 1 && len == 7 && p[7] == '\0') {
+            // no need for a display, which may not even exist with -H
+            c = rgb;
+        } else if (strlen(p) || !ncolors) {
+            if (!dpy) {
+                // we'll need an X display for this... yuck!
+                if (!(dpy = XOpenDisplay(NULL))) {
+                    fprintf(stderr, "can't open display\n");
+                    exit(EXIT_FAILURE);
+                }
+                cmap = DefaultColormap(dpy, 0);
+            }
+
             XColor color;
             if (!XParseColor(dpy, cmap, p, &color)) {
                 fprintf(stderr, "can't parse color: %s\n", p);
@@ -124,6 +180,10 @@ static void parse_colors(char *s)
 
         p = strsep(&s, ",");
     }
+
+    if (dpy) {
+        XCloseDisplay(dpy);
+    }
 }
 
 
@@ -169,10 +229,39 @@ static void parse_heights(char *s)
 }
 
 
+// "port[,level[,slope[,hysteresis[,holdoff]]]]", empty fields keep their defaults
+static void parse_trigger(char *s)
+{
+    char *p = strsep(&s, ",");
+    g_trigger_port = atoi(p) - 1;
+    if (g_trigger_port < 0) {
+        fprintf(stderr, "invalid trigger port: %s\n", p);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((p = strsep(&s, ",")) && strlen(p)) {
+        g_trigger_level = atof(p);
+    }
+    if ((p = strsep(&s, ",")) && strlen(p)) {
+        if (strcmp(p, "+") != 0 && strcmp(p, "-") != 0) {
+            fprintf(stderr, "invalid trigger slope: %s\n", p);
+            exit(EXIT_FAILURE);
+        }
+        g_trigger_falling = *p == '-';
+    }
+    if ((p = strsep(&s, ",")) && strlen(p)) {
+        g_trigger_hysteresis = max(atof(p), 0.0f);
+    }
+    if ((p = strsep(&s, ",")) && strlen(p)) {
+        g_trigger_holdoff = max(atof(p), 0.0f);
+    }
+}
+
+
 static void process_options(int argc, char *argv[])
 {
     int c;
-    const char *optstring = "N:n:d:c::s::x:y:C:S:Y:g::G::f:h";
+    const char *optstring = "N:n:d:c::i::r::s::T:x:y:C:S:Y:g::G::v::p::t::a:P:w:I:R:f:J::l:m:H:A:h";
 
     optind = 1;
     opterr = 1;
@@ -194,9 +283,18 @@ static void process_options(int argc, char *argv[])
             case 'c':
                 g_show_clipping = optional_bool(optarg);
                 break;
+            case 'i':
+                g_density = optional_bool(optarg);
+                break;
+            case 'r':
+                g_show_rms = optional_bool(optarg);
+                break;
             case 's':
                 g_scrolling = !optional_bool(optarg);
                 break;
+            case 'T':
+                parse_trigger(optarg);
+                break;
             case 'x':
                 g_width = atoi(optarg);
                 break;
@@ -218,11 +316,48 @@ static void process_options(int argc, char *argv[])
             case 'G':
                 g_use_gl = !optional_bool(optarg);
                 break;
+            case 'v':
+                g_use_vbo = optional_bool(optarg);
+                break;
+            case 'p':
+                g_prereduce = optional_bool(optarg);
+                break;
+            case 't':
+                g_analysis_thread = optional_bool(optarg);
+                break;
+            case 'a':
+                g_analysis_cpu = atoi(optarg);
+                break;
+            case 'P':
+                g_analysis_priority = atoi(optarg);
+                break;
+            case 'w':
+                g_nworkers = max(atoi(optarg), 1);
+                break;
+            case 'I':
+                g_source = optarg;
+                break;
+            case 'R':
+                g_speed = atof(optarg);
+                break;
             case 'f':
-              { int fps = atoi(optarg);
-                if (fps) g_ticks_per_frame = 1000 / fps;
-                    else g_ticks_per_frame = 0;
-              } break;
+                g_fps = max(atof(optarg), 0.0f);
+                break;
+            case 'J':
+                g_phase_lock = optional_bool(optarg);
+                break;
+            case 'l':
+                g_max_latency = atof(optarg);
+                break;
+            case 'm':
+                g_stats_file = optarg;
+                break;
+            case 'H':
+                g_headless = optarg;
+                break;
+            case 'A':
+                g_archive_file = optarg;
+                break;
             case 'h':
                 print_usage();
                 exit(EXIT_SUCCESS);
@@ -262,6 +397,62 @@ static void process_configfile()
 }
 
 
+static void adjust()
+{
+    // the analysis thread must not touch the buffers while they're being replaced
+    waves_lock();
+    audio_adjust();
+    waves_adjust();
+    waves_unlock();
+}
+
+
+static void set_duration(float duration)
+{
+    // don't zoom in any further than one sample per pixel
+    if (audio_get_samplerate() * duration / g_width < 1.0f) {
+        return;
+    }
+
+    g_duration = duration;
+    adjust();
+}
+
+
+// shows in the window title which part of the archive is being viewed
+static void update_caption()
+{
+    double behind, column;
+
+    if (waves_get_archive_view(&behind, &column)) {
+        int s = behind + 0.5;
+        char caption[256];
+        snprintf(caption, sizeof(caption), "%s - archive, -%d:%02d:%02d, %g s per pixel",
+                 audio_get_client_name(), s / 3600, s / 60 % 60, s % 60, column);
+        SDL_WM_SetCaption(caption, NULL);
+    } else {
+        SDL_WM_SetCaption(audio_get_client_name(), NULL);
+    }
+}
+
+
+static void main_stop(int sig)
+{
+    (void)sig;
+    g_run = false;
+}
+
+
+// registered after everything has been initialized, so that it runs before any of the
+// other exit handlers: the audio source is stopped first, so its callbacks can't run into
+// the analysis thread while that's being shut down
+static void main_shutdown()
+{
+    audio_stop();
+    waves_stop_thread();
+}
+
+
 static void main_exit()
 {
     free(g_colors);
@@ -313,32 +504,144 @@ int main(int argc, char *argv[])
         g_total_height = g_height;
     }
 
+    // with -p, the audio has already been analyzed by the time it's buffered
+    if (g_prereduce) {
+        g_analysis_thread = false;
+    }
+
+    if (g_density) {
+        // the histograms are made while drawing, and there may be more than one line per track
+        g_prereduce = false;
+        g_analysis_thread = false;
+        g_use_vbo = false;
+        // the brightness already shows where the signal spends its time
+        g_show_rms = false;
+    }
 
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (g_trigger_port >= g_nports) {
+        fprintf(stderr, "invalid trigger port: %d\n", g_trigger_port + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    if (g_trigger_port >= 0) {
+        // the trigger is searched for in the samples themselves. everything between
+        // the sweeps is skipped anyway, and isn't kept either
+        g_prereduce = false;
+        g_analysis_thread = false;
+        g_max_latency = 0.0f;
+        g_archive_file = NULL;
+        // every sweep starts at the left edge
+        g_scrolling = false;
+    }
+
+    if (g_headless) {
+        // there's no window, and frames are paced by the audio rather than the clock.
+        // so nothing is ever late, and there's no vsync to wait for
+        g_use_gl = false;
+        g_phase_lock = false;
+        g_max_latency = 0.0f;
+        if (g_fps == 0) g_fps = DEFAULT_FPS;
+
+        if (strcmp(g_headless, "-") == 0 && g_stats_file && strcmp(g_stats_file, "-") == 0) {
+            fprintf(stderr, "can't write both frames and statistics to stdout\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (SDL_Init(g_headless ? 0 : SDL_INIT_VIDEO) < 0) {
         fprintf(stderr, "can't init SDL: %s\n", SDL_GetError());
         exit(EXIT_FAILURE);
     }
     atexit(SDL_Quit);
 
-    audio_init(g_client_name, (const char * const *)&argv[optind]);
+    analyze_init();
+    analyze_set_rms(g_show_rms);
+
+    audio_init(g_client_name, g_source, (const char * const *)&argv[optind]);
+
+    if (g_archive_file) {
+        archive_init(g_archive_file);
+    }
+
+    if (g_headless) {
+        headless_init(g_headless);
+        // without a window, there's no other way to quit
+        signal(SIGINT, main_stop);
+        signal(SIGTERM, main_stop);
+    }
 
     video_init();
-    SDL_WM_SetCaption(audio_get_client_name(), NULL);
+    if (!g_headless) {
+        update_caption();
+    }
 
     waves_init();
 
+    stats_init(g_stats_file);
+
+    atexit(main_shutdown);
+
     g_run = true;
 
+    audio_start();
+
     while (g_run)
     {
-        while (SDL_PollEvent(&event))
+        while (!g_headless && SDL_PollEvent(&event))
         {
             switch (event.type)
             {
                 case SDL_VIDEORESIZE:
                     video_resize(event.resize.w, event.resize.h);
-                    audio_adjust();
-                    waves_adjust();
+                    adjust();
+                    break;
+                case SDL_KEYDOWN:
+                    switch (event.key.keysym.sym) {
+                        case SDLK_PLUS:
+                        case SDLK_EQUALS:
+                        case SDLK_KP_PLUS:
+                            if (waves_archive_shown()) {
+                                waves_zoom_archive(0.5);
+                            } else {
+                                set_duration(g_duration / 2);
+                            }
+                            break;
+                        case SDLK_MINUS:
+                        case SDLK_KP_MINUS:
+                            if (waves_archive_shown()) {
+                                waves_zoom_archive(2.0);
+                            } else {
+                                set_duration(g_duration * 2);
+                            }
+                            break;
+                        case SDLK_h:
+                            waves_toggle_archive();
+                            break;
+                        case SDLK_LEFT:
+                            waves_scroll_archive(-0.25);
+                            break;
+                        case SDLK_RIGHT:
+                            waves_scroll_archive(0.25);
+                            break;
+                        case SDLK_PAGEUP:
+                            waves_scroll_archive(-1.0);
+                            break;
+                        case SDLK_PAGEDOWN:
+                            waves_scroll_archive(1.0);
+                            break;
+                        case SDLK_HOME:
+                            waves_scroll_archive(-HUGE_VAL);
+                            break;
+                        case SDLK_END:
+                            waves_scroll_archive(HUGE_VAL);
+                            break;
+                        case SDLK_o:
+                            stats_toggle_overlay();
+                            break;
+                        default:
+                            break;
+                    }
+                    update_caption();
                     break;
                 case SDL_QUIT:
                     g_run = false;
@@ -347,7 +650,17 @@ int main(int argc, char *argv[])
         }
 
         waves_draw();
+        stats_draw();
         video_flip();
+        stats_frame();
+    }
+
+    // let the user know if the display couldn't keep up
+    unsigned long dropped = audio_get_dropped();
+    unsigned long skips = waves_get_skips();
+    if (dropped || skips) {
+        fprintf(stderr, "%lu periods dropped, %lu columns skipped in %lu jumps\n",
+                dropped, waves_get_skipped_columns(), skips);
     }
 
     return 0;
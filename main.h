@@ -22,20 +22,39 @@
 #define DEFAULT_HEIGHT_MAX          480
 #define DEFAULT_FPS                 50
 #define DEFAULT_DURATION            5
+#define DEFAULT_TRIGGER_HYSTERESIS  0.02f
 
 
 extern bool     g_run;
 extern int      g_nports;
 
-extern int      g_ticks_per_frame;
+extern float    g_fps;
+extern bool     g_phase_lock;
 extern bool     g_scrolling;
 extern int      g_width;
 extern int      g_height;
 extern int      g_total_height;
 extern bool     g_use_gl;
+extern bool     g_use_vbo;
+extern bool     g_prereduce;
+extern bool     g_analysis_thread;
+extern int      g_analysis_cpu;
+extern int      g_analysis_priority;
+extern int      g_nworkers;
+extern float    g_speed;
+extern float    g_max_latency;
+extern char const *g_headless;
 
 extern float    g_duration;
 extern bool     g_show_clipping;
+extern bool     g_density;
+extern bool     g_show_rms;
+
+extern int      g_trigger_port;
+extern float    g_trigger_level;
+extern bool     g_trigger_falling;
+extern float    g_trigger_hysteresis;
+extern float    g_trigger_holdoff;
 
 extern Uint32  *g_colors;
 extern float   *g_scales;
@@ -0,0 +1,290 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * performance counters. everything is collected over intervals of one second,
+ * then shown in the overlay and/or written to the stats file as one line of
+ * key=value pairs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "stats.h"
+#include "video.h"
+#include "audio.h"
+#include "waves.h"
+#include "util.h"
+
+#define STATS_INTERVAL      1000000000
+#define STATS_LINES         11
+#define STATS_LINE_LENGTH   64
+
+
+typedef struct {
+    uint64_t sum;
+    uint64_t count;
+    uint64_t max;
+} stats_timer;
+
+// upper bounds of the frame time histogram's bins, in milliseconds. the last bin has no bound
+static int const histogram_bins[] = { 5, 10, 15, 17, 20, 25, 33, 50, 100 };
+#define STATS_BINS  (int)(sizeof(histogram_bins) / sizeof(histogram_bins[0]) + 1)
+
+
+static void stats_exit();
+
+static FILE *file = NULL;
+static bool overlay = false;
+
+// written by several threads, so only ever accessed atomically
+static stats_timer timers[STATS_NTIMERS];
+
+// everything else belongs to the GUI thread
+static int64_t start_time;
+static int64_t interval_start;
+static int64_t last_frame = 0;
+static int frames;
+static int64_t frame_sum, frame_max;
+static int histogram[STATS_BINS];
+static float fill_sum, fill_max;
+static int columns, columns_sum, columns_max;
+static unsigned long last_dropped, last_skipped;
+
+// age of the newest column on screen at every frame, in milliseconds
+static float *ages = NULL;
+static int nages, ages_size = 0;
+
+static char lines[STATS_LINES][STATS_LINE_LENGTH];
+static char const *line_ptrs[STATS_LINES];
+
+
+void stats_init(const char *path)
+{
+    if (path) {
+        if (strcmp(path, "-") == 0) {
+            file = stdout;
+        } else if (!(file = fopen(path, "w"))) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int n = 0; n < STATS_LINES; n++) {
+        line_ptrs[n] = lines[n];
+    }
+
+    start_time = interval_start = stats_now();
+
+    atexit(stats_exit);
+}
+
+
+static void stats_exit()
+{
+    if (file && file != stdout) {
+        fclose(file);
+    }
+    free(ages);
+}
+
+
+void stats_add(stats_timer_id id, int64_t ns)
+{
+    stats_timer *t = &timers[id];
+    uint64_t d = ns > 0 ? ns : 0;
+
+    __atomic_fetch_add(&t->sum, d, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t m = __atomic_load_n(&t->max, __ATOMIC_RELAXED);
+    while (d > m && !__atomic_compare_exchange_n(&t->max, &m, d, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+}
+
+
+void stats_add_columns(int n)
+{
+    columns += n;
+}
+
+
+void stats_toggle_overlay()
+{
+    overlay = !overlay;
+
+    if (!overlay) {
+        video_clear_overlay();
+    }
+}
+
+
+static int stats_compare_ages(void const *a, void const *b)
+{
+    float x = *(float const *)a, y = *(float const *)b;
+    return (x > y) - (x < y);
+}
+
+
+// the given percentile of the ages, which must be sorted
+static float stats_percentile(float p)
+{
+    if (!nages) return 0.0f;
+    int n = (int)(p / 100.0f * nages + 0.5f) - 1;
+    return ages[min(max(n, 0), nages - 1)];
+}
+
+
+// takes the timer's values for the last interval, and starts over. results are in milliseconds
+static void stats_take_timer(stats_timer_id id, double *mean, double *max)
+{
+    stats_timer *t = &timers[id];
+
+    uint64_t sum = __atomic_exchange_n(&t->sum, 0, __ATOMIC_RELAXED);
+    uint64_t count = __atomic_exchange_n(&t->count, 0, __ATOMIC_RELAXED);
+    uint64_t m = __atomic_exchange_n(&t->max, 0, __ATOMIC_RELAXED);
+
+    *mean = count ? sum / (double)count * 1e-6 : 0.0;
+    *max = m * 1e-6;
+}
+
+
+static void stats_report(int64_t now)
+{
+    double seconds = (now - interval_start) * 1e-9;
+    double fps = frames / seconds;
+    double frame_mean = frames ? frame_sum / (double)frames * 1e-6 : 0.0;
+    double columns_mean = frames ? columns_sum / (double)frames : 0.0;
+    double fill_mean = frames ? fill_sum / frames : 0.0;
+
+    double mean[STATS_NTIMERS], max[STATS_NTIMERS];
+    for (int n = 0; n < STATS_NTIMERS; n++) {
+        stats_take_timer(n, &mean[n], &max[n]);
+    }
+
+    qsort(ages, nages, sizeof(float), stats_compare_ages);
+    float age_mean = 0.0f;
+    for (int n = 0; n < nages; n++) {
+        age_mean += ages[n] / nages;
+    }
+    float age_50 = stats_percentile(50), age_95 = stats_percentile(95), age_99 = stats_percentile(99);
+    float age_max = nages ? ages[nages - 1] : 0.0f;
+
+    unsigned long dropped = audio_get_dropped();
+    unsigned long skipped = waves_get_skipped_columns();
+
+    snprintf(lines[0], STATS_LINE_LENGTH, "fps %.1f  frame %.1f ms  max %.1f", fps, frame_mean, frame_max * 1e-6);
+    snprintf(lines[1], STATS_LINE_LENGTH, "process %.1f us  max %.1f", mean[STATS_PROCESS] * 1e3, max[STATS_PROCESS] * 1e3);
+    snprintf(lines[2], STATS_LINE_LENGTH, "ring %.0f%%  max %.0f%%", fill_mean * 100, fill_max * 100);
+    snprintf(lines[3], STATS_LINE_LENGTH, "columns %.1f/frame  max %d", columns_mean, columns_max);
+    snprintf(lines[4], STATS_LINE_LENGTH, "analyze %.3f ms  max %.3f", mean[STATS_ANALYZE], max[STATS_ANALYZE]);
+    snprintf(lines[5], STATS_LINE_LENGTH, "upload %.3f ms  max %.3f", mean[STATS_UPLOAD], max[STATS_UPLOAD]);
+    snprintf(lines[6], STATS_LINE_LENGTH, "swap %.3f ms  max %.3f", mean[STATS_SWAP], max[STATS_SWAP]);
+    // (the totals since startup, the file has those of the last interval)
+    snprintf(lines[7], STATS_LINE_LENGTH, "total dropped %lu  skipped %lu", dropped, skipped);
+    snprintf(lines[8], STATS_LINE_LENGTH, "age p50 %.1f ms  p95 %.1f  p99 %.1f  max %.1f", age_50, age_95, age_99, age_max);
+
+    // the histogram takes two lines
+    for (int l = 0; l < 2; l++) {
+        int len = 0;
+        lines[9 + l][0] = '\0';
+        for (int b = l * STATS_BINS / 2; b < (l + 1) * STATS_BINS / 2 && len < STATS_LINE_LENGTH; b++) {
+            // snprintf() returns the length it would have needed, so len can end up past the end
+            if (b < STATS_BINS - 1) {
+                len += snprintf(lines[9 + l] + len, STATS_LINE_LENGTH - len, "<%d:%d ", histogram_bins[b], histogram[b]);
+            } else {
+                len += snprintf(lines[9 + l] + len, STATS_LINE_LENGTH - len, ">%d:%d", histogram_bins[b - 1], histogram[b]);
+            }
+        }
+    }
+
+    if (file) {
+        fprintf(file, "time=%.3f frames=%d fps=%.2f frame_ms=%.3f frame_max_ms=%.3f", (now - start_time) * 1e-9,
+                frames, fps, frame_mean, frame_max * 1e-6);
+        fprintf(file, " process_us=%.2f process_max_us=%.2f", mean[STATS_PROCESS] * 1e3, max[STATS_PROCESS] * 1e3);
+        fprintf(file, " ring_fill=%.3f ring_fill_max=%.3f columns=%.2f columns_max=%d",
+                fill_mean, fill_max, columns_mean, columns_max);
+        fprintf(file, " analyze_ms=%.4f analyze_max_ms=%.4f upload_ms=%.4f upload_max_ms=%.4f swap_ms=%.4f swap_max_ms=%.4f",
+                mean[STATS_ANALYZE], max[STATS_ANALYZE], mean[STATS_UPLOAD], max[STATS_UPLOAD],
+                mean[STATS_SWAP], max[STATS_SWAP]);
+        fprintf(file, " age_ms=%.2f age_p50_ms=%.2f age_p95_ms=%.2f age_p99_ms=%.2f age_max_ms=%.2f",
+                age_mean, age_50, age_95, age_99, age_max);
+        fprintf(file, " dropped=%lu skipped=%lu histogram=", dropped - last_dropped, skipped - last_skipped);
+        for (int b = 0; b < STATS_BINS; b++) {
+            fprintf(file, b ? ",%d" : "%d", histogram[b]);
+        }
+        fprintf(file, "\n");
+        fflush(file);
+    }
+
+    last_dropped = dropped;
+    last_skipped = skipped;
+
+    interval_start = now;
+    frames = 0;
+    frame_sum = frame_max = 0;
+    fill_sum = fill_max = 0.0f;
+    columns_sum = columns_max = 0;
+    nages = 0;
+    memset(histogram, 0, sizeof(histogram));
+}
+
+
+void stats_frame()
+{
+    int64_t now = stats_now();
+
+    if (last_frame) {
+        int64_t t = now - last_frame;
+        frame_sum += t;
+        frame_max = t > frame_max ? t : frame_max;
+
+        int b = 0;
+        while (b < STATS_BINS - 1 && t >= histogram_bins[b] * (int64_t)1000000) {
+            b++;
+        }
+        histogram[b]++;
+        frames++;
+
+        float fill = audio_get_fill();
+        fill_sum += fill;
+        fill_max = fill > fill_max ? fill : fill_max;
+
+        columns_sum += columns;
+        columns_max = columns > columns_max ? columns : columns_max;
+    }
+
+    // the frame has just been shown, so this is how old the newest audio on screen is
+    jack_nframes_t time;
+    if (waves_get_column_time(&time)) {
+        int32_t age = audio_get_frame_time() - time;
+        if (nages == ages_size) {
+            ages_size = max(ages_size * 2, 256);
+            ages = (float*)realloc(ages, ages_size * sizeof(float));
+        }
+        ages[nages++] = age * 1000.0f / audio_get_samplerate();
+    }
+    last_frame = now;
+    columns = 0;
+
+    if (now - interval_start >= STATS_INTERVAL) {
+        stats_report(now);
+    }
+}
+
+
+void stats_draw()
+{
+    if (overlay) {
+        video_draw_overlay(line_ptrs, STATS_LINES);
+    }
+}
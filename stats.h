@@ -0,0 +1,45 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// the things we measure the duration of
+typedef enum {
+    STATS_PROCESS,      // writing one period to the buffer, in the audio thread
+    STATS_ANALYZE,      // one call to waves_analyze_frames()
+    STATS_UPLOAD,       // updating the window from the new columns
+    STATS_SWAP,         // showing the finished frame
+    STATS_NTIMERS
+} stats_timer_id;
+
+void stats_init(const char *path);
+
+static inline int64_t stats_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// safe to call from any thread, including the JACK process callback
+void stats_add(stats_timer_id id, int64_t ns);
+
+// called by the GUI thread
+void stats_add_columns(int n);
+void stats_frame();
+void stats_draw();
+void stats_toggle_overlay();
+
+#endif // _STATS_H
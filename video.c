@@ -11,26 +11,57 @@
 
 #include <SDL.h>
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
 
 #include "main.h"
 #include "video.h"
+#include "audio.h"
+#include "stats.h"
+#include "font.h"
+#include "headless.h"
 #include "util.h"
 
 #define VIDEO_BPP       0
 #define VIDEO_FLAGS_SDL (SDL_RESIZABLE | SDL_SWSURFACE)
 #define VIDEO_FLAGS_GL  (SDL_RESIZABLE | SDL_OPENGL)
 #define SURFACE_FLAGS   SDL_SWSURFACE
-#define TEXTURE_WIDTH   64
+
+// the pixel buffer is split into sections, one per frame, so the GPU can still read
+// from one while the next frame's columns are being written to another
+#define PBO_SECTIONS        3
+#define PBO_SECTION_COLUMNS 256
+
+// with -J, frames are shown this far into a JACK period, by which time the process callback
+// should be done with the audio that just arrived
+#define PHASE_LOCK_OFFSET   0.25
+
+// the overlay is rendered to a surface of this size, text beyond it is cut off
+#define OVERLAY_WIDTH       512
+#define OVERLAY_HEIGHT      128
+#define OVERLAY_MARGIN      4
+#define OVERLAY_SPACING     2
 
 
 static void video_exit();
+static void video_load_procs();
+static void video_create_texture();
+static void video_create_pbo();
+static void video_pbo_next_section();
+static void video_create_lines();
+static void video_create_overlay();
+static void video_flush_lines();
 
 void (*video_update)(int, int);
 static void video_update_gl(int, int);
+static void video_update_lines(int, int);
 static void video_update_sdl(int, int);
 
 
@@ -40,30 +71,97 @@ static SDL_Surface *draw_surface = NULL;
 
 static SDL_PixelFormat *pix_fmt = NULL;
 
-static unsigned int ticks = 0;
+// writes one column of pixels, step bytes apart, specialized for the surface's bytes per pixel
+static void (*video_raster_column)(Uint8 *, int, video_span const *, int);
+static void video_raster_column_1(Uint8 *, int, video_span const *, int);
+static void video_raster_column_2(Uint8 *, int, video_span const *, int);
+static void video_raster_column_3(Uint8 *, int, video_span const *, int);
+static void video_raster_column_4(Uint8 *, int, video_span const *, int);
+
+// frame n is due at frame_epoch + n * frame period. counting frames from a fixed point
+// in time, rather than from the previous frame, means rounding errors don't add up
+static int64_t frame_epoch = 0;
+static int64_t frame_count = -1;
 
 typedef struct {
     bool use;
     SDL_Rect rect;
 } update_rect;
 
-static update_rect update_rects[2];
+// the two parts of the window that new columns have been drawn to, and the overlay
+static update_rect update_rects[3];
+static bool update_all = false;
+static bool update_columns = false;     // new columns have been drawn since the last update
 
-static GLuint *textures = NULL;
-static int    num_textures = 0;
+// one texture holds the whole window, one column per row
+static GLuint texture = 0;
 static float  tex_coord_h;
+static float  tex_coord_w;
 static int    max_texture_size = 0;
 
+// the one or two quads that show the texture, streamed to the GPU every frame
+typedef struct {
+    GLfloat x, y;
+    GLfloat s, t;
+} quad_vertex;
+
+static GLuint quad_buffer = 0;
+
+// new columns are copied to a pixel buffer and uploaded from there, if the driver supports it.
+// this way the texture transfer happens asynchronously, and we never wait for it
+static GLuint pbo = 0;
+static Uint8 *pbo_map = NULL;       // persistent mapping, if available
+static GLsync pbo_fences[PBO_SECTIONS];
+static size_t pbo_section_size;
+static int    pbo_section = 0;
+static size_t pbo_offset = 0;       // write position within the current section
+static bool   pbo_busy = false;     // the GPU is still reading the current section
+static bool   pbo_persistent = false;
+
+// columns that have been drawn to the staging surface (or vertex array), but not uploaded yet.
+// this span never wraps around
+static int    upload_start = 0;
+static int    upload_end = 0;
+
+// with -v, each column is a vertical line per track (three with -r), two vertices each.
+// the vertex buffer holds one column per pixel, just like the texture
+typedef struct {
+    GLshort x, y;
+    Uint32 color;
+} line_vertex;
+
+static line_vertex *vertices = NULL;
+static int lines_per_column;
+static GLuint vertex_buffer = 0;
+
+// text shown on top of the waveform, rendered in software first
+static SDL_Surface *overlay = NULL;
+static SDL_Rect overlay_rect = { 0, 0, 0, 0 };
+static GLuint overlay_texture = 0;
+
+static PFNGLGENBUFFERSPROC      gl_gen_buffers;
+static PFNGLDELETEBUFFERSPROC   gl_delete_buffers;
+static PFNGLBINDBUFFERPROC      gl_bind_buffer;
+static PFNGLBUFFERDATAPROC      gl_buffer_data;
+static PFNGLBUFFERSUBDATAPROC   gl_buffer_sub_data;
+
+static PFNGLMAPBUFFERRANGEPROC  gl_map_buffer_range;
+static PFNGLUNMAPBUFFERPROC     gl_unmap_buffer;
+static PFNGLBUFFERSTORAGEPROC   gl_buffer_storage;
+static PFNGLFENCESYNCPROC       gl_fence_sync;
+static PFNGLCLIENTWAITSYNCPROC  gl_client_wait_sync;
+static PFNGLDELETESYNCPROC      gl_delete_sync;
+
 
 void video_init()
 {
-    for (int n = 0; n < 2; n++) {
+    for (int n = 0; n < 3; n++) {
         update_rects[n].use = false;
     }
 
     if (g_use_gl)
     {
-        if (g_ticks_per_frame == 0) {
+        if (g_fps == 0) {
             // attempt to enable vsync, which makes scrolling more smooth.
             // this probably has no effect on anything but nVidia cards.
             setenv("__GL_SYNC_TO_VBLANK", "1", 0);
@@ -92,28 +190,51 @@ static void video_exit()
 {
     if (g_use_gl)
     {
-        glDeleteTextures(num_textures, textures);
+        if (g_use_vbo) {
+            gl_delete_buffers(1, &vertex_buffer);
+            free(vertices);
+        } else {
+            glDeleteTextures(1, &texture);
+            gl_delete_buffers(1, &quad_buffer);
+            if (pbo) {
+                for (int n = 0; n < PBO_SECTIONS; n++) {
+                    if (pbo_fences[n]) gl_delete_sync(pbo_fences[n]);
+                }
+                gl_delete_buffers(1, &pbo);
+            }
+        }
+        glDeleteTextures(1, &overlay_texture);
         SDL_FreeSurface(buffer);
-        free(textures);
     }
     else
     {
         if (g_scrolling) SDL_FreeSurface(buffer);
+        if (g_headless) SDL_FreeSurface(screen);
     }
+    SDL_FreeSurface(overlay);
 }
 
 
 void video_set_mode(int w, int h)
 {
-    if (g_use_gl && max_texture_size != 0 && h > max_texture_size) {
+    if (g_use_gl && !g_use_vbo && max_texture_size != 0 && (w > max_texture_size || h > max_texture_size)) {
         fprintf(stderr, "maximum OpenGL texture size exceeded\n");
-        h = max_texture_size;
+        w = min(w, max_texture_size);
+        h = min(h, max_texture_size);
     }
 
     g_width = w;
     g_height = h;
 
-    if ((screen = SDL_SetVideoMode(g_width, g_height, VIDEO_BPP, (g_use_gl ? VIDEO_FLAGS_GL : VIDEO_FLAGS_SDL))) == NULL)
+    if (g_headless)
+    {
+        // no window, just a surface of the same size
+        if (screen) SDL_FreeSurface(screen);
+        screen = SDL_CreateRGBSurface(SDL_SWSURFACE, g_width, g_height, 32,
+                                      HEADLESS_RMASK, HEADLESS_GMASK, HEADLESS_BMASK, 0);
+        SDL_FillRect(screen, NULL, 0);
+    }
+    else if ((screen = SDL_SetVideoMode(g_width, g_height, VIDEO_BPP, (g_use_gl ? VIDEO_FLAGS_GL : VIDEO_FLAGS_SDL))) == NULL)
     {
         fprintf(stderr, "can't set video mode: %s\n", SDL_GetError());
         if (g_use_gl) {
@@ -126,41 +247,14 @@ void video_set_mode(int w, int h)
     {
         glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
 
-        if (textures) glDeleteTextures(num_textures, textures);
-
-        num_textures = (int)ceilf((float)g_width / (float)TEXTURE_WIDTH);
-        textures = (GLuint*)realloc(textures, num_textures * sizeof(GLuint));
-        glGenTextures(num_textures, textures);
-
-        int tex_w = TEXTURE_WIDTH;
-        int tex_h = next_power_of_two(g_height);
-        tex_coord_h = (float)g_height / (float)tex_h;
-
-        // used to initially fill the textures
-        void *black_pixels = calloc(tex_w * tex_h, 4);
+        video_load_procs();
 
-        for (int n = 0; n < num_textures; n++)
-        {
-            glBindTexture(GL_TEXTURE_2D, textures[n]);
-
-            // empty error flags
-            while (glGetError()) { }
-            // width and height swapped, so that we're able to change the texture one row at a time
-            // (more efficient than one column!)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_h, tex_w, 0, GL_RGBA, GL_UNSIGNED_BYTE, black_pixels);
-            if (glGetError()) {
-                fprintf(stderr, "failed to create texture of size %dx%d, sorry\n", tex_h, tex_w);
-                exit(EXIT_FAILURE);
-            }
-
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (g_use_vbo) {
+            video_create_lines();
+        } else {
+            video_create_texture();
         }
 
-        free(black_pixels);
-
         glClear(GL_COLOR_BUFFER_BIT);
 
         glViewport(0, 0, g_width, g_height);
@@ -174,8 +268,9 @@ void video_set_mode(int w, int h)
 
         if (buffer) SDL_FreeSurface(buffer);
 
-        // give OpenGL the pixel format it expects
-        buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, g_height, 32,
+        // staging surface with all columns stored as rows, just like in the texture (not needed for lines).
+        // give OpenGL the pixel format it expects (the line colors use it, too)
+        buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, g_height, g_use_vbo ? 1 : g_width, 32,
 #if SDL_BYTEORDER == SDL_LIL_ENDIAN
             0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000
 #else
@@ -183,9 +278,18 @@ void video_set_mode(int w, int h)
 #endif
         );
         pix_fmt = buffer->format;
+        upload_start = upload_end = 0;
+
+        if (!g_use_vbo) {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, buffer->pitch / 4);
+            video_create_pbo();
+        }
 
         draw_surface = buffer;
-        video_update = video_update_gl;
+        video_raster_column = video_raster_column_4;
+        video_update = g_use_vbo ? video_update_lines : video_update_gl;
+
+        video_create_overlay();
     }
     else // SDL
     {
@@ -193,44 +297,445 @@ void video_set_mode(int w, int h)
 
         if (g_scrolling) {
             if (buffer) SDL_FreeSurface(buffer);
-            buffer = SDL_CreateRGBSurface(SURFACE_FLAGS, g_width, g_height, pix_fmt->BitsPerPixel,
+            // every column is drawn twice, side by side, so the window's contents
+            // are always one contiguous part of this surface
+            buffer = SDL_CreateRGBSurface(SURFACE_FLAGS, 2 * g_width, g_height, pix_fmt->BitsPerPixel,
                                           pix_fmt->Rmask, pix_fmt->Gmask, pix_fmt->Bmask, pix_fmt->Amask);
             draw_surface = buffer;
         } else {
             draw_surface = screen;
         }
+
+        switch (pix_fmt->BytesPerPixel) {
+            case 1: video_raster_column = video_raster_column_1; break;
+            case 2: video_raster_column = video_raster_column_2; break;
+            case 3: video_raster_column = video_raster_column_3; break;
+            default: video_raster_column = video_raster_column_4; break;
+        }
         video_update = video_update_sdl;
+
+        video_create_overlay();
     }
 }
 
 
+static void video_create_texture()
+{
+    if (texture) glDeleteTextures(1, &texture);
+    if (quad_buffer) gl_delete_buffers(1, &quad_buffer);
+
+    glGenTextures(1, &texture);
+    gl_gen_buffers(1, &quad_buffer);
+
+    int tex_w = next_power_of_two(g_width);
+    int tex_h = next_power_of_two(g_height);
+    tex_coord_h = (float)g_height / (float)tex_h;
+    tex_coord_w = 1.0f / (float)tex_w;
+
+    // used to initially fill the texture
+    void *black_pixels = calloc((size_t)tex_w * tex_h, 4);
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // empty error flags
+    while (glGetError()) { }
+    // width and height swapped, so that we're able to change the texture one row at a time
+    // (more efficient than one column!)
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_h, tex_w, 0, GL_RGBA, GL_UNSIGNED_BYTE, black_pixels);
+    if (glGetError()) {
+        fprintf(stderr, "failed to create texture of size %dx%d, sorry\n", tex_h, tex_w);
+        exit(EXIT_FAILURE);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    free(black_pixels);
+}
+
+
+static void *video_get_proc(char const *name)
+{
+    void *proc = SDL_GL_GetProcAddress(name);
+    if (!proc) {
+        fprintf(stderr, "OpenGL function %s not available\n", name);
+        fprintf(stderr, "you may want to try disabling OpenGL support using the -G command line option\n");
+        exit(EXIT_FAILURE);
+    }
+    return proc;
+}
+
+
+static void video_load_procs()
+{
+    gl_gen_buffers = (PFNGLGENBUFFERSPROC)video_get_proc("glGenBuffers");
+    gl_delete_buffers = (PFNGLDELETEBUFFERSPROC)video_get_proc("glDeleteBuffers");
+    gl_bind_buffer = (PFNGLBINDBUFFERPROC)video_get_proc("glBindBuffer");
+    gl_buffer_data = (PFNGLBUFFERDATAPROC)video_get_proc("glBufferData");
+    gl_buffer_sub_data = (PFNGLBUFFERSUBDATAPROC)video_get_proc("glBufferSubData");
+}
+
+
+static bool video_has_gl(int major, int minor, char const *extension)
+{
+    int v_major = 0, v_minor = 0;
+    sscanf((char const *)glGetString(GL_VERSION), "%d.%d", &v_major, &v_minor);
+    if (v_major > major || (v_major == major && v_minor >= minor)) {
+        return true;
+    }
+
+    // look for the extension name as a whole word
+    char const *extensions = (char const *)glGetString(GL_EXTENSIONS);
+    size_t len = strlen(extension);
+    for (char const *p = extensions; p && (p = strstr(p, extension)); p += len) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void video_create_pbo()
+{
+    if (pbo) {
+        for (int n = 0; n < PBO_SECTIONS; n++) {
+            if (pbo_fences[n]) gl_delete_sync(pbo_fences[n]);
+        }
+        gl_delete_buffers(1, &pbo);
+        pbo = 0;
+        pbo_map = NULL;
+    }
+
+    // without sync objects, we couldn't tell when a section can be reused
+    if (!video_has_gl(3, 2, "GL_ARB_sync") || !video_has_gl(3, 0, "GL_ARB_map_buffer_range") ||
+            !video_has_gl(2, 1, "GL_ARB_pixel_buffer_object")) {
+        return;
+    }
+
+    gl_map_buffer_range = (PFNGLMAPBUFFERRANGEPROC)video_get_proc("glMapBufferRange");
+    gl_unmap_buffer = (PFNGLUNMAPBUFFERPROC)video_get_proc("glUnmapBuffer");
+    gl_fence_sync = (PFNGLFENCESYNCPROC)video_get_proc("glFenceSync");
+    gl_client_wait_sync = (PFNGLCLIENTWAITSYNCPROC)video_get_proc("glClientWaitSync");
+    gl_delete_sync = (PFNGLDELETESYNCPROC)video_get_proc("glDeleteSync");
+
+    pbo_persistent = video_has_gl(4, 4, "GL_ARB_buffer_storage");
+    if (pbo_persistent) {
+        gl_buffer_storage = (PFNGLBUFFERSTORAGEPROC)video_get_proc("glBufferStorage");
+    }
+
+    pbo_section_size = (size_t)min(g_width, PBO_SECTION_COLUMNS) * buffer->pitch;
+    size_t size = PBO_SECTIONS * pbo_section_size;
+
+    gl_gen_buffers(1, &pbo);
+    gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+
+    if (pbo_persistent) {
+        // map the buffer once, and keep writing to it while the GPU reads from it
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        gl_buffer_storage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+        pbo_map = (Uint8*)gl_map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    } else {
+        gl_buffer_data(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+
+    gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (pbo_persistent && !pbo_map) {
+        // just upload directly then
+        gl_delete_buffers(1, &pbo);
+        pbo = 0;
+        return;
+    }
+
+    for (int n = 0; n < PBO_SECTIONS; n++) {
+        pbo_fences[n] = NULL;
+    }
+    pbo_section = 0;
+    pbo_offset = 0;
+    pbo_busy = false;
+}
+
+
+// uploads the given rows of the staging surface through the pixel buffer.
+// returns false if that's not possible without waiting, the caller should upload directly then
+static bool video_pbo_upload(int row, int nrows)
+{
+    size_t size = (size_t)nrows * buffer->pitch;
+
+    if (!pbo || pbo_busy || pbo_offset + size > pbo_section_size) {
+        return false;
+    }
+
+    if (pbo_offset == 0 && pbo_fences[pbo_section]) {
+        // has the GPU finished reading this section? don't wait if it hasn't
+        GLenum r = gl_client_wait_sync(pbo_fences[pbo_section], 0, 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) {
+            pbo_busy = true;
+            return false;
+        }
+        gl_delete_sync(pbo_fences[pbo_section]);
+        pbo_fences[pbo_section] = NULL;
+    }
+
+    size_t offset = pbo_section * pbo_section_size + pbo_offset;
+    Uint8 const *pixels = (Uint8 const *)buffer->pixels + row * buffer->pitch;
+
+    gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+
+    if (pbo_map) {
+        memcpy(pbo_map + offset, pixels, size);
+    } else {
+        // the fence already tells us this range isn't in use anymore
+        void *p = gl_map_buffer_range(GL_PIXEL_UNPACK_BUFFER, offset, size,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!p) {
+            gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+        memcpy(p, pixels, size);
+        gl_unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, g_height, nrows, GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+
+    gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    pbo_offset += size;
+    return true;
+}
+
+
+// called once per frame, after all uploads
+static void video_pbo_next_section()
+{
+    if (!pbo || (pbo_offset == 0 && !pbo_busy)) {
+        // nothing written, this section can be used for the next frame
+        return;
+    }
+
+    if (pbo_offset) {
+        pbo_fences[pbo_section] = gl_fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    pbo_section = (pbo_section + 1) % PBO_SECTIONS;
+    pbo_offset = 0;
+    pbo_busy = false;
+}
+
+
+static void video_create_lines()
+{
+    if (vertex_buffer) gl_delete_buffers(1, &vertex_buffer);
+
+    lines_per_column = g_nports * (g_show_rms ? 3 : 1);
+    size_t size = (size_t)g_width * lines_per_column * 2 * sizeof(line_vertex);
+
+    // all lines start out with zero length, which draws nothing
+    vertices = (line_vertex*)realloc(vertices, size);
+    memset(vertices, 0, size);
+
+    gl_gen_buffers(1, &vertex_buffer);
+    gl_bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+    gl_buffer_data(GL_ARRAY_BUFFER, size, vertices, GL_STREAM_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+static void video_create_overlay()
+{
+    if (overlay) SDL_FreeSurface(overlay);
+
+    // same pixel format as the columns, so it can be drawn the same way
+    overlay = SDL_CreateRGBSurface(SDL_SWSURFACE, OVERLAY_WIDTH, OVERLAY_HEIGHT, pix_fmt->BitsPerPixel,
+                                   pix_fmt->Rmask, pix_fmt->Gmask, pix_fmt->Bmask, pix_fmt->Amask);
+    overlay_rect.w = overlay_rect.h = 0;
+
+    if (g_use_gl) {
+        if (overlay_texture) glDeleteTextures(1, &overlay_texture);
+        glGenTextures(1, &overlay_texture);
+        glBindTexture(GL_TEXTURE_2D, overlay_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, OVERLAY_WIDTH, OVERLAY_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, overlay->pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+}
+
+
+void video_invalidate()
+{
+    // the whole window has been redrawn
+    update_all = true;
+}
+
+
 void video_resize(int w, int h)
 {
     video_set_mode(w, h);
 }
 
 
+static inline void video_store_pixel(Uint8 *p, int bpp, Uint32 color)
+{
+    switch (bpp) {
+        case 1: *p = color; break;
+        case 2: *(Uint16*)p = color; break;
+        case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+            p[0] = color; p[1] = color >> 8; p[2] = color >> 16;
+#else
+            p[0] = color >> 16; p[1] = color >> 8; p[2] = color;
+#endif
+            break;
+        default: *(Uint32*)p = color; break;
+    }
+}
+
+
+// fills a whole column from top to bottom in one go: the spans in their colors,
+// everything in between black. the spans must be sorted from top to bottom
+static inline void video_raster_column_bpp(Uint8 *p, int step, int bpp,
+                                           video_span const *spans, int nspans)
+{
+    int y = 0;
+
+    for (int n = 0; n <= nspans; n++)
+    {
+        int y_start = g_height, y_end = g_height;
+        if (n < nspans) {
+            y_start = min(max(spans[n].y, y), g_height);
+            y_end = min(max(spans[n].y + spans[n].h, y_start), g_height);
+        }
+
+        for ( ; y < y_start; y++, p += step) {
+            video_store_pixel(p, bpp, 0);
+        }
+        for ( ; y < y_end; y++, p += step) {
+            video_store_pixel(p, bpp, spans[n].color);
+        }
+    }
+}
+
+static void video_raster_column_1(Uint8 *p, int step, video_span const *spans, int nspans) {
+    video_raster_column_bpp(p, step, 1, spans, nspans);
+}
+static void video_raster_column_2(Uint8 *p, int step, video_span const *spans, int nspans) {
+    video_raster_column_bpp(p, step, 2, spans, nspans);
+}
+static void video_raster_column_3(Uint8 *p, int step, video_span const *spans, int nspans) {
+    video_raster_column_bpp(p, step, 3, spans, nspans);
+}
+static void video_raster_column_4(Uint8 *p, int step, video_span const *spans, int nspans) {
+    video_raster_column_bpp(p, step, 4, spans, nspans);
+}
+
+
+void video_lock()
+{
+    SDL_LockSurface(draw_surface);
+}
+
+
+void video_unlock()
+{
+    SDL_UnlockSurface(draw_surface);
+}
+
+
+void video_draw_column(int pos, video_span const *spans, int nspans)
+{
+    if (g_use_gl && g_use_vbo) {
+        // one line per span, or none at all
+        for (int n = 0; n < lines_per_column; n++) {
+            line_vertex *v = vertices + (pos * lines_per_column + n) * 2;
+            if (n < nspans) {
+                v[0].x = v[1].x = pos;
+                v[0].y = spans[n].y;
+                v[1].y = spans[n].y + spans[n].h;
+                v[0].color = v[1].color = spans[n].color;
+            } else {
+                memset(v, 0, 2 * sizeof(line_vertex));
+            }
+        }
+    } else if (g_use_gl) {
+        // in the texture, the column is represented as one row!
+        video_raster_column((Uint8*)buffer->pixels + pos * buffer->pitch, 4, spans, nspans);
+    } else {
+        Uint8 *p = (Uint8*)draw_surface->pixels + pos * pix_fmt->BytesPerPixel;
+        video_raster_column(p, draw_surface->pitch, spans, nspans);
+        if (g_scrolling) {
+            video_raster_column(p + g_width * pix_fmt->BytesPerPixel, draw_surface->pitch, spans, nspans);
+        }
+    }
+}
+
+
 void video_update_line(int pos)
 {
+    update_columns = true;
+
     if (g_use_gl) {
-        SDL_LockSurface(buffer);
-        glBindTexture(GL_TEXTURE_2D, textures[pos / TEXTURE_WIDTH]);
-        // in the texture, the column is represented as one row!
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, pos % TEXTURE_WIDTH, g_height, 1, GL_RGBA, GL_UNSIGNED_BYTE, buffer->pixels);
-        SDL_UnlockSurface(buffer);
+        if (upload_end > upload_start && (pos < upload_start || pos > upload_end)) {
+            video_flush_lines();
+        }
+        // just remember the column, it will be uploaded together with its neighbours
+        if (upload_end > upload_start) {
+            upload_end = max(upload_end, pos + 1);
+        } else {
+            upload_start = pos;
+            upload_end = pos + 1;
+        }
+    }
+}
+
+
+static void video_flush_lines()
+{
+    if (upload_end <= upload_start) {
+        return;
     }
+
+    if (g_use_vbo) {
+        size_t column_size = lines_per_column * 2 * sizeof(line_vertex);
+        gl_bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+        gl_buffer_sub_data(GL_ARRAY_BUFFER, upload_start * column_size, (upload_end - upload_start) * column_size,
+                           vertices + upload_start * lines_per_column * 2);
+        gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+        upload_start = upload_end = 0;
+        return;
+    }
+
+    SDL_LockSurface(buffer);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (!video_pbo_upload(upload_start, upload_end - upload_start)) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload_start, g_height, upload_end - upload_start, GL_RGBA, GL_UNSIGNED_BYTE,
+                        (Uint8*)buffer->pixels + upload_start * buffer->pitch);
+    }
+    SDL_UnlockSurface(buffer);
+
+    upload_start = upload_end = 0;
 }
 
 
-static inline void video_draw_quad(int x, GLuint tex) {
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glBegin(GL_QUADS);
+// sets up a quad showing count columns of the texture, starting at column first
+static inline int video_set_quad(quad_vertex *q, int x, int first, int count)
+{
+    if (count == 0) {
+        return 0;
+    }
+
     // x and y texture coordinates are swapped
-    glTexCoord2f(0.0f,        0.0f); glVertex2i(x,                 0);
-    glTexCoord2f(0.0f,        1.0f); glVertex2i(x + TEXTURE_WIDTH, 0);
-    glTexCoord2f(tex_coord_h, 1.0f); glVertex2i(x + TEXTURE_WIDTH, g_height);
-    glTexCoord2f(tex_coord_h, 0.0f); glVertex2i(x,                 g_height);
-    glEnd();
+    float t0 = first * tex_coord_w;
+    float t1 = (first + count) * tex_coord_w;
+
+    q[0] = (quad_vertex){ x,         0,        0.0f,        t0 };
+    q[1] = (quad_vertex){ x + count, 0,        0.0f,        t1 };
+    q[2] = (quad_vertex){ x + count, g_height, tex_coord_h, t1 };
+    q[3] = (quad_vertex){ x,         g_height, tex_coord_h, t0 };
+
+    return 4;
 }
 
 
@@ -238,57 +743,118 @@ static void video_update_gl(int pos, int prev_pos)
 {
     (void)prev_pos;
 
-    glEnable(GL_TEXTURE_2D);
+    video_flush_lines();
+    video_pbo_next_section();
 
-    glColor3f(1.0f, 1.0f, 1.0f);
+    quad_vertex quads[8];
+    int nvertices;
 
-    if (g_scrolling)
-    {
-        // this texture needs to be drawn twice
-        int ntex = pos / TEXTURE_WIDTH;
-        video_draw_quad((ntex * TEXTURE_WIDTH) - pos, textures[ntex]);
-        // now start with last quad, this way the last one overlapping the first is not an issue
-        for (int n = num_textures - 1; n >= 0; n--) {
-            video_draw_quad((g_width - pos + n * TEXTURE_WIDTH) % g_width, textures[n]);
-        }
-    }
-    else
-    {
-        for (int n = 0; n < num_textures; n++) {
-            video_draw_quad(n * TEXTURE_WIDTH, textures[n]);
-        }
+    if (g_scrolling) {
+        // the oldest column is at pos, so the texture is shown in two parts
+        nvertices = video_set_quad(quads, 0, pos, g_width - pos);
+        nvertices += video_set_quad(quads + nvertices, g_width - pos, 0, pos);
+    } else {
+        nvertices = video_set_quad(quads, 0, 0, g_width);
     }
 
+    gl_bind_buffer(GL_ARRAY_BUFFER, quad_buffer);
+    gl_buffer_data(GL_ARRAY_BUFFER, sizeof(quads), quads, GL_STREAM_DRAW);
+
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glColor3f(1.0f, 1.0f, 1.0f);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(quad_vertex), (void*)offsetof(quad_vertex, x));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(quad_vertex), (void*)offsetof(quad_vertex, s));
+
+    glDrawArrays(GL_QUADS, 0, nvertices);
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+
     glDisable(GL_TEXTURE_2D);
 }
 
 
+static inline void video_draw_lines(float x, int first, int count)
+{
+    glPushMatrix();
+    // the lines are drawn through the pixel centers
+    glTranslatef(x + 0.5f, 0.0f, 0.0f);
+    glDrawArrays(GL_LINES, first * lines_per_column * 2, count * lines_per_column * 2);
+    glPopMatrix();
+}
+
+
+static void video_update_lines(int pos, int prev_pos)
+{
+    (void)prev_pos;
+
+    video_flush_lines();
+
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    gl_bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_SHORT, sizeof(line_vertex), (void*)offsetof(line_vertex, x));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(line_vertex), (void*)offsetof(line_vertex, color));
+
+    glMatrixMode(GL_MODELVIEW);
+
+    if (g_scrolling) {
+        // scrolling is just a matter of where the two parts of the buffer are drawn
+        video_draw_lines(-pos, pos, g_width - pos);
+        video_draw_lines(g_width - pos, 0, pos);
+    } else {
+        video_draw_lines(0, 0, g_width);
+    }
+
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+
 static void video_update_sdl(int pos, int prev_pos)
 {
+    if (!update_columns && !update_all)
+    {
+        // nothing has changed, don't copy anything to the screen
+        return;
+    }
+
+    update_columns = false;
+
     if (g_scrolling)
     {
-        /*          pos
-        *  +--------+--------------------+
-        *  | r_src1 |       r_src2       |  buffer
-        *  +--------+--------------------+
+        /*                 pos                 pos + g_width
+        *  +---------------+--------------------+---------------+
+        *  |               |       r_src        |               |  buffer
+        *  +---------------+--------------------+---------------+
         *
-        *  +--------------------+--------+
-        *  |      r_dst2        | r_dst1 |  screen
-        *  +--------------------+--------+
+        *                  +--------------------+
+        *                  |       r_dst        |  screen
+        *                  +--------------------+
         */
 
-        // left part of source surface first
-        SDL_Rect r_src1 = { 0, 0, pos, g_height };
-        SDL_Rect r_dst1 = { g_width - pos, 0, 0, 0 };
-        SDL_BlitSurface(buffer, &r_src1, screen, &r_dst1);
-        // now the second part
-        SDL_Rect r_src2 = { pos, 0, g_width - pos, g_height };
-        SDL_Rect r_dst2 = { 0, 0, 0, 0 };
-        SDL_BlitSurface(buffer, &r_src2, screen, &r_dst2);
+        SDL_Rect r_src = { pos, 0, g_width, g_height };
+        SDL_Rect r_dst = { 0, 0, 0, 0 };
+        SDL_BlitSurface(buffer, &r_src, screen, &r_dst);
 
         // need to update whole window
         update_rects[0].rect.x = update_rects[0].rect.y = update_rects[0].rect.w = update_rects[0].rect.h = 0;
         update_rects[0].use = true;
+        update_all = false;
+    }
+    else if (update_all)
+    {
+        update_rects[0].rect.x = update_rects[0].rect.y = update_rects[0].rect.w = update_rects[0].rect.h = 0;
+        update_rects[0].use = true;
+        update_all = false;
     }
     else
     {
@@ -321,20 +887,196 @@ static void video_update_sdl(int pos, int prev_pos)
 }
 
 
+// renders the given lines of text to the overlay surface, returns the area used
+static SDL_Rect video_render_overlay(char const * const *lines, int nlines)
+{
+    int bpp = overlay->format->BytesPerPixel;
+    Uint32 white = SDL_MapRGB(overlay->format, 255, 255, 255);
+
+    int len = 0;
+    for (int l = 0; l < nlines; l++) {
+        len = max(len, (int)strlen(lines[l]));
+    }
+
+    SDL_Rect r = { 0, 0,
+                   min(2 * OVERLAY_MARGIN + len * (FONT_WIDTH + 1), OVERLAY_WIDTH),
+                   min(2 * OVERLAY_MARGIN + nlines * (FONT_HEIGHT + OVERLAY_SPACING), OVERLAY_HEIGHT) };
+    SDL_FillRect(overlay, &r, SDL_MapRGB(overlay->format, 0, 0, 0));
+
+    SDL_LockSurface(overlay);
+
+    for (int l = 0; l < nlines; l++) {
+        int y0 = OVERLAY_MARGIN + l * (FONT_HEIGHT + OVERLAY_SPACING);
+
+        for (int c = 0; lines[l][c] != '\0'; c++) {
+            int x0 = OVERLAY_MARGIN + c * (FONT_WIDTH + 1);
+            Uint8 const *glyph = font_get_glyph(lines[l][c]);
+
+            for (int y = 0; y < FONT_HEIGHT; y++) {
+                for (int x = 0; x < FONT_WIDTH; x++) {
+                    if ((glyph[y] >> (FONT_WIDTH - 1 - x) & 1) && x0 + x < r.w && y0 + y < r.h) {
+                        Uint8 *p = (Uint8*)overlay->pixels + (y0 + y) * overlay->pitch + (x0 + x) * bpp;
+                        video_store_pixel(p, bpp, white);
+                    }
+                }
+            }
+        }
+    }
+
+    SDL_UnlockSurface(overlay);
+
+    return r;
+}
+
+
+// draws text in the top left corner of the window, on top of whatever video_update() has drawn
+void video_draw_overlay(char const * const *lines, int nlines)
+{
+    SDL_Rect r = video_render_overlay(lines, nlines);
+    SDL_Rect prev = overlay_rect;
+    overlay_rect = r;
+
+    if (g_use_gl)
+    {
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, overlay_texture);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, overlay->pitch / 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, r.w, r.h, GL_RGBA, GL_UNSIGNED_BYTE, overlay->pixels);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, buffer->pitch / 4);
+        glColor3f(1.0f, 1.0f, 1.0f);
+
+        float s = (float)r.w / OVERLAY_WIDTH;
+        float t = (float)r.h / OVERLAY_HEIGHT;
+
+        glBegin(GL_QUADS);
+        glTexCoord2f(0.0f, 0.0f);
+        glVertex2i(0, 0);
+        glTexCoord2f(s, 0.0f);
+        glVertex2i(r.w, 0);
+        glTexCoord2f(s, t);
+        glVertex2i(r.w, r.h);
+        glTexCoord2f(0.0f, t);
+        glVertex2i(0, r.h);
+        glEnd();
+
+        glDisable(GL_TEXTURE_2D);
+    }
+    else
+    {
+        SDL_Rect dst = { 0, 0, 0, 0 };
+        SDL_BlitSurface(overlay, &r, screen, &dst);
+
+        // if the overlay has shrunk, the rest of the previous one needs to go, too
+        update_rects[2].rect.x = update_rects[2].rect.y = 0;
+        update_rects[2].rect.w = min(max(r.w, prev.w), g_width);
+        update_rects[2].rect.h = min(max(r.h, prev.h), g_height);
+        update_rects[2].use = true;
+    }
+}
+
+
+// removes the overlay from the window
+void video_clear_overlay()
+{
+    if (!g_use_gl && overlay_rect.w)
+    {
+        if (g_scrolling) {
+            // the whole window is copied from the buffer again
+            video_invalidate();
+        } else {
+            // the columns have been drawn to the screen directly, so what was behind
+            // the overlay is gone. clear it, it will be drawn again as time goes by
+            SDL_FillRect(screen, &overlay_rect, 0);
+            update_rects[2].rect = overlay_rect;
+            update_rects[2].rect.w = min(overlay_rect.w, g_width);
+            update_rects[2].rect.h = min(overlay_rect.h, g_height);
+            update_rects[2].use = true;
+        }
+    }
+    overlay_rect.w = overlay_rect.h = 0;
+}
+
+
+// moves the deadline to the point shortly after the next JACK period starts,
+// so that every frame sees complete periods
+static int64_t video_phase_lock(int64_t deadline, int64_t now)
+{
+    jack_nframes_t position, period;
+    if (!audio_get_cycle_position(&position, &period)) {
+        return deadline;
+    }
+
+    double ns_per_frame = 1e9 / audio_get_samplerate();
+    int64_t period_ns = period * ns_per_frame;
+    int64_t cycle = now - (int64_t)(position * ns_per_frame) + (int64_t)(PHASE_LOCK_OFFSET * period_ns);
+
+    // the first such point in time that's not before the deadline, and not in the past
+    deadline = max(deadline, now);
+    if (deadline > cycle) {
+        cycle += (deadline - cycle + period_ns - 1) / period_ns * period_ns;
+    }
+    return cycle;
+}
+
+
+static void video_wait_frame()
+{
+    if (g_fps <= 0) {
+        // unlimited, or synced to the display by vsync
+        return;
+    }
+
+    int64_t now = stats_now();
+    double period = 1e9 / g_fps;
+
+    if (frame_count < 0) {
+        frame_epoch = now;
+        frame_count = 0;
+        return;
+    }
+
+    int64_t deadline = frame_epoch + (int64_t)(++frame_count * period);
+
+    if (deadline < now - period) {
+        // we're more than a frame late. start counting from here, rather than
+        // rushing through the missed frames
+        frame_epoch = now;
+        frame_count = 0;
+        return;
+    }
+
+    if (g_phase_lock) {
+        deadline = video_phase_lock(deadline, now);
+    }
+
+    struct timespec ts = { deadline / 1000000000, deadline % 1000000000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) { }
+}
+
+
 void video_flip()
 {
-    while (SDL_GetTicks() < ticks + g_ticks_per_frame) {
-        SDL_Delay(1);
+    // without a window, frames are paced by the audio, not by the clock
+    if (!g_headless) {
+        video_wait_frame();
     }
-    ticks = SDL_GetTicks();
+
+    int64_t t = stats_now();
 
     if (g_use_gl)
     {
         SDL_GL_SwapBuffers();
     }
+    else if (g_headless)
+    {
+        headless_write_frame(screen);
+        for (int n = 0; n < 3; n++) {
+            update_rects[n].use = false;
+        }
+    }
     else
     {
-        for (int n = 0; n < 2; n++) {
+        for (int n = 0; n < 3; n++) {
             if (update_rects[n].use) {
                 SDL_UpdateRect(screen, update_rects[n].rect.x, update_rects[n].rect.y,
                                        update_rects[n].rect.w, update_rects[n].rect.h);
@@ -342,6 +1084,8 @@ void video_flip()
             }
         }
     }
+
+    stats_add(STATS_SWAP, stats_now() - t);
 }
 
 
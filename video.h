@@ -12,11 +12,24 @@
 #ifndef _VIDEO_H
 #define _VIDEO_H
 
+// a vertical run of pixels of one color, within one column
+typedef struct {
+    int y, h;
+    Uint32 color;
+} video_span;
+
+
 void video_init();
 void video_set_mode(int w, int h);
 void video_resize(int w, int h);
+void video_lock();
+void video_unlock();
+void video_draw_column(int pos, video_span const *spans, int nspans);
 void video_update_line(int);
+void video_invalidate();
 void video_flip();
+void video_draw_overlay(char const * const *lines, int nlines);
+void video_clear_overlay();
 
 extern void (*video_update)(int, int);
 
@@ -9,30 +9,68 @@
  * (at your option) any later version.
  */
 
+#define _GNU_SOURCE
+
 #include <SDL.h>
 #include <GL/gl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
 
 #include "main.h"
 #include "video.h"
 #include "audio.h"
+#include "analyze.h"
+#include "history.h"
+#include "archive.h"
+#include "workers.h"
 #include "waves.h"
+#include "stats.h"
 #include "util.h"
 
+#define BATCH_COLUMNS       256
+#define TASKS_PER_WORKER    4
+
+// with g_density, the number of brightness levels, and how many octaves below "all samples
+// of the column in one row" the dimmest one stands for
+#define DENSITY_LEVELS      16
+#define DENSITY_RANGE       12.0f
+
+// with g_show_rms, each track is drawn as three spans, see waves_line_to_spans()
+#define WAVES_SPANS_PER_TRACK   (g_show_rms ? 3 : 1)
 
+
+// with g_show_rms, rms_upper to rms_lower is the part of the line covered by the rms band
 typedef struct {
     int upper;
     int lower;
+    int rms_upper;
+    int rms_lower;
     bool clipping;
 } waves_line;
 
+// a column to be analyzed, as one or two segments of the ring buffer.
+// len is the number of samples in the first segment
+typedef struct {
+    sample_t const *seg[2];
+    unsigned int len;
+    jack_nframes_t nframes;
+} waves_column;
+
 
 static void waves_exit();
 
-static void waves_clear_line_all(int);
-static void waves_draw_line(int, int, waves_line*);
+static int waves_line_to_spans(int, waves_line*, video_span*);
+static void waves_draw_column(analyze_peak const *, bool);
+static void waves_redraw();
+static void waves_draw_archive();
+static void waves_start_thread();
 
 static void (*waves_draw_play_head)(int);
 
@@ -40,22 +78,101 @@ static void waves_draw_play_head_gl(int);
 static void waves_draw_play_head_sdl(int);
 
 
-static sample_t *frames = NULL;
 static int *track_heights = NULL;
 static int *track_yoffsets = NULL;
 static int *draw_heights = NULL;
+static analyze_peak *peaks = NULL;
+static video_span *spans = NULL;
 static jack_nframes_t frames_per_line;
 static int draw_pos = 0;
 
+// columns are analyzed in batches, each worker taking care of a group of ports
+// in all columns of the batch
+static waves_column *batch = NULL;
+static analyze_peak *batch_peaks = NULL;
+static int batch_size;
+static int batch_ports;
+
+// with g_density, each column is also analyzed as a histogram of the rows its samples fall into,
+// which is then turned into spans of equal brightness. batch_spans has room for g_height spans
+// per column, those of each track starting at its y offset
+static bool batch_histograms = false;
+static analyze_hist *hists = NULL;
+static unsigned int *hist_bins = NULL;
+static video_span *batch_spans = NULL;
+static int *batch_nspans = NULL;
+// the column of the batch being passed on to waves_add_column(), or -1
+static int density_column = -1;
+
 static Uint32 *colors = NULL;
 static Uint32 *colors_clipping = NULL;
+// a lighter shade of each, for the rms band
+static Uint32 *colors_rms = NULL;
+static Uint32 *colors_rms_clipping = NULL;
 static Uint32 color_position;
+static Uint32 color_skipped;
+// DENSITY_LEVELS + 1 shades of each track's colors, from black to full brightness
+static Uint32 *ramps = NULL;
+static Uint32 *ramps_clipping = NULL;
+
+// with g_max_latency, whatever the display falls behind by is folded into a single column
+static analyze_peak *skip_peaks = NULL;
+static unsigned long skips = 0;
+static unsigned long skipped_columns = 0;
+
+// columns drawn during the current waves_draw()
+static int new_columns = 0;
+
+// with g_headless, how many columns the frames are behind the audio they stand for
+static double headless_columns = 0.0;
+
+// frame time of the last sample of the newest column drawn
+static jack_nframes_t column_time;
+static bool column_time_valid = false;
+
+// while the archive is shown instead of the live display, view_end is the frame at the
+// right edge of the window, or the newest frame archived if view_follow is set
+static bool view_shown = false;
+static bool view_follow;
+static uint64_t view_end;
+static uint64_t view_frames_per_line;
+
+// with g_trigger_port, the state of the search for the next trigger, and how many frames of
+// holdoff are left before it's searched for again. if a trigger has been found but its sweep
+// isn't complete yet, sweep_pending is set, and the sweep starts at the beginning of the ring
+// buffer. the trigger_scanned frames from there on have been searched already
+static analyze_trigger trigger;
+static jack_nframes_t holdoff_left = 0;
+static bool sweep_pending = false;
+static jack_nframes_t trigger_scanned = 0;
+// with g_headless, how many frames the sweeps have run ahead of the time the frames stand for
+static int64_t trigger_ahead = 0;
+
+// with g_analysis_thread, columns are analyzed in a thread of their own, and the GUI
+// thread only draws the finished peaks. the mutex keeps the analysis thread out while
+// buffers and resolution are being changed
+static pthread_t thread;
+static bool thread_running = false;
+static sem_t thread_wakeup;
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 void waves_init()
 {
     colors = (Uint32*)calloc(g_nports, sizeof(Uint32));
     colors_clipping = (Uint32*)calloc(g_nports, sizeof(Uint32));
+    peaks = (analyze_peak*)calloc(g_nports, sizeof(analyze_peak));
+    skip_peaks = (analyze_peak*)calloc(g_nports, sizeof(analyze_peak));
+    spans = (video_span*)calloc(g_nports * WAVES_SPANS_PER_TRACK, sizeof(video_span));
+    batch = (waves_column*)calloc(BATCH_COLUMNS, sizeof(waves_column));
+    batch_peaks = (analyze_peak*)calloc(BATCH_COLUMNS * g_nports, sizeof(analyze_peak));
+
+    // several tasks per worker, so the work can still be balanced if one of them is slow.
+    // but whole vectors of ports each, otherwise the kernels fall back to narrower ones
+    int ntasks = g_nworkers > 1 ? min(g_nworkers * TASKS_PER_WORKER, g_nports) : 1;
+    int width = analyze_get_width();
+    batch_ports = (g_nports + ntasks - 1) / ntasks;
+    batch_ports = (batch_ports + width - 1) / width * width;
 
     for (int n = 0; n < g_nports; ++n) {
         Uint32 c;
@@ -73,7 +190,40 @@ void waves_init()
         colors_clipping[n] = SDL_MapRGB(video_get_pix_fmt(), 255 - r, 255 - g, 255 - b);
     }
 
+    if (g_show_rms) {
+        colors_rms = (Uint32*)calloc(g_nports, sizeof(Uint32));
+        colors_rms_clipping = (Uint32*)calloc(g_nports, sizeof(Uint32));
+
+        // halfway between the color and white
+        for (int n = 0; n < g_nports; ++n) {
+            Uint8 r, g, b;
+            SDL_GetRGB(colors[n], video_get_pix_fmt(), &r, &g, &b);
+            colors_rms[n] = SDL_MapRGB(video_get_pix_fmt(), (r + 255) / 2, (g + 255) / 2, (b + 255) / 2);
+            SDL_GetRGB(colors_clipping[n], video_get_pix_fmt(), &r, &g, &b);
+            colors_rms_clipping[n] = SDL_MapRGB(video_get_pix_fmt(), (r + 255) / 2, (g + 255) / 2, (b + 255) / 2);
+        }
+    }
+
+    if (g_density) {
+        ramps = (Uint32*)calloc(g_nports * (DENSITY_LEVELS + 1), sizeof(Uint32));
+        ramps_clipping = (Uint32*)calloc(g_nports * (DENSITY_LEVELS + 1), sizeof(Uint32));
+        hists = (analyze_hist*)calloc(g_nports, sizeof(analyze_hist));
+        batch_nspans = (int*)calloc(BATCH_COLUMNS * g_nports, sizeof(int));
+
+        for (int n = 0; n < g_nports; ++n) {
+            Uint8 r, g, b;
+            SDL_GetRGB(colors[n], video_get_pix_fmt(), &r, &g, &b);
+            for (int k = 0; k <= DENSITY_LEVELS; k++) {
+                ramps[n * (DENSITY_LEVELS + 1) + k] = SDL_MapRGB(video_get_pix_fmt(),
+                    r * k / DENSITY_LEVELS, g * k / DENSITY_LEVELS, b * k / DENSITY_LEVELS);
+                ramps_clipping[n * (DENSITY_LEVELS + 1) + k] = SDL_MapRGB(video_get_pix_fmt(),
+                    (255 - r) * k / DENSITY_LEVELS, (255 - g) * k / DENSITY_LEVELS, (255 - b) * k / DENSITY_LEVELS);
+            }
+        }
+    }
+
     color_position = SDL_MapRGB(video_get_pix_fmt(), 255, 255, 255);
+    color_skipped = SDL_MapRGB(video_get_pix_fmt(), 128, 128, 128);
 
     if (g_use_gl) {
         waves_draw_play_head = waves_draw_play_head_gl;
@@ -81,19 +231,57 @@ void waves_init()
         waves_draw_play_head = waves_draw_play_head_sdl;
     }
 
+    if (g_trigger_port >= 0) {
+        analyze_trigger_init(&trigger, g_trigger_level, g_trigger_falling, g_trigger_hysteresis);
+    }
+
+    history_init();
+    workers_init(g_nworkers);
+
     waves_adjust();
     atexit(waves_exit);
+
+    if (g_analysis_thread) {
+        waves_start_thread();
+    }
+}
+
+
+// stops the analysis thread. the audio source has to be stopped before,
+// otherwise it might still try to wake up the thread
+void waves_stop_thread()
+{
+    if (__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&thread_running, false, __ATOMIC_RELEASE);
+        sem_post(&thread_wakeup);
+        pthread_join(thread, NULL);
+        sem_destroy(&thread_wakeup);
+    }
 }
 
 
 static void waves_exit()
 {
+    waves_stop_thread();
+
+    free(batch);
+    free(batch_peaks);
     free(colors);
     free(colors_clipping);
-    free(frames);
+    free(colors_rms);
+    free(colors_rms_clipping);
+    free(peaks);
+    free(skip_peaks);
+    free(spans);
     free(track_heights);
     free(track_yoffsets);
     free(draw_heights);
+    free(ramps);
+    free(ramps_clipping);
+    free(hists);
+    free(hist_bins);
+    free(batch_spans);
+    free(batch_nspans);
 }
 
 
@@ -119,11 +307,53 @@ void waves_adjust()
         draw_heights[n] = track_heights[n] - (int)(track_heights[n] % 2 == 0);
     }
 
+    if (g_density) {
+        // a column may consist of up to one span per pixel
+        spans = (video_span*)realloc(spans, max(g_height, g_nports * WAVES_SPANS_PER_TRACK) * sizeof(video_span));
+        batch_spans = (video_span*)realloc(batch_spans, BATCH_COLUMNS * g_height * sizeof(video_span));
+        hist_bins = (unsigned int*)realloc(hist_bins, g_nports * ANALYZE_HIST_COPIES * g_height * sizeof(unsigned int));
+
+        // one bin per row, using the same scale as waves_peak_to_line()
+        for (int n = 0; n < g_nports; ++n) {
+            hists[n].nbins = max(draw_heights[n], 1);
+            hists[n].offset = draw_heights[n] / 2.0f;
+            hists[n].scale = hists[n].offset * (g_scales ? g_scales[n] : 1.0f);
+            hists[n].bins = hist_bins + n * ANALYZE_HIST_COPIES * g_height;
+        }
+    }
+
     // don't allow frames_per_line to be zero
     frames_per_line = max((audio_get_samplerate() * g_duration) / g_width, 1);
+
+    waves_redraw();
+
+    history_adjust(frames_per_line, g_width);
+}
+
+
+// redraws the whole window from what we've seen so far, at the current resolution
+static void waves_redraw()
+{
+    if (view_shown) {
+        waves_draw_archive();
+        return;
+    }
+
     draw_pos = 0;
 
-    frames = (sample_t*)realloc(frames, frames_per_line * sizeof(sample_t));
+    // the history only keeps peaks, not histograms, so with g_density the window starts out empty
+    // rather than redrawing the past as plain bars
+    analyze_peak *columns = (analyze_peak*)malloc(g_width * g_nports * sizeof(analyze_peak));
+    int ncolumns = g_density ? 0 : history_get(frames_per_line, g_width, columns);
+
+    video_lock();
+    for (int x = 0; x < g_width; x++) {
+        waves_draw_column(x < g_width - ncolumns ? NULL : columns + x * g_nports, false);
+    }
+    video_unlock();
+
+    free(columns);
+    video_invalidate();
 }
 
 
@@ -135,22 +365,234 @@ int waves_samples_per_pixel()
 
 int waves_samples_per_frame()
 {
-    return audio_get_samplerate() * g_ticks_per_frame / 1000;
+    return g_fps > 0 ? audio_get_samplerate() / g_fps : 0;
+}
+
+
+// how many columns the display may be behind, or 0 if that's not limited
+static jack_nframes_t waves_latency_columns()
+{
+    if (g_max_latency <= 0.0f) {
+        return 0;
+    }
+
+    // anything beyond one window width would be overwritten right away anyway
+    jack_nframes_t n = g_max_latency / 1000.0f * audio_get_samplerate() / frames_per_line;
+    return min(max(n, (jack_nframes_t)1), (jack_nframes_t)g_width);
+}
+
+
+unsigned long waves_get_skips()
+{
+    return skips;
 }
 
 
-static inline void waves_analyze_frames(int ntrack, waves_line *line)
+unsigned long waves_get_skipped_columns()
 {
-    sample_t maxi = frames[0];
-    sample_t mini = frames[0];
-    line->clipping = false;
+    return skipped_columns;
+}
+
+
+bool waves_get_column_time(jack_nframes_t *time)
+{
+    *time = column_time;
+    return column_time_valid;
+}
+
 
-    // find maximum and minimum sample value
-    for (unsigned int i = 1; i < frames_per_line; i++) {
-        if (frames[i] > maxi) maxi = frames[i];
-        if (frames[i] < mini) mini = frames[i];
-        if (frames[i] >= 1.0 || frames[i] <= -1.0) line->clipping = true;
+// draws the part of the archive in view, and a blank column for every one
+// that's before the beginning of the archive
+static void waves_draw_archive()
+{
+    uint64_t total = archive_get_frames();
+    if (view_follow) {
+        view_end = total;
+    }
+
+    draw_pos = 0;
+
+    video_lock();
+    for (int x = 0; x < g_width; x++) {
+        uint64_t back = (uint64_t)(g_width - x) * view_frames_per_line;
+        bool found = back <= view_end && archive_get(view_end - back, view_frames_per_line, peaks);
+        waves_draw_column(found ? peaks : NULL, false);
     }
+    video_unlock();
+
+    video_invalidate();
+}
+
+
+// in follow mode, appends the columns archived since the view was last drawn,
+// like the live display does
+static void waves_follow_archive()
+{
+    uint64_t n = (archive_get_frames() - view_end) / view_frames_per_line;
+
+    if (n >= (uint64_t)g_width) {
+        // nothing that's on screen now would remain
+        waves_draw_archive();
+        return;
+    }
+
+    video_lock();
+    for (; n; n--) {
+        bool found = archive_get(view_end, view_frames_per_line, peaks);
+        view_end += view_frames_per_line;
+        waves_draw_column(found ? peaks : NULL, false);
+    }
+    video_unlock();
+}
+
+
+void waves_toggle_archive()
+{
+    if (!archive_is_open()) {
+        return;
+    }
+
+    view_shown = !view_shown;
+
+    if (view_shown) {
+        // start out at the live display's resolution, as long as the archive has that much
+        view_frames_per_line = max((jack_nframes_t)frames_per_line, archive_get_resolution());
+        view_follow = true;
+    }
+
+    waves_redraw();
+}
+
+
+bool waves_archive_shown()
+{
+    return view_shown;
+}
+
+
+// moves the view by the given number of window widths, towards the present if positive
+void waves_scroll_archive(double screens)
+{
+    if (!view_shown) return;
+
+    uint64_t total = archive_get_frames();
+    double end = (double)view_end + screens * g_width * view_frames_per_line;
+
+    if (end >= total) {
+        view_follow = true;
+    } else {
+        // don't scroll any further back than to the beginning of the archive
+        view_follow = false;
+        view_end = min(max(end, (double)g_width * view_frames_per_line), (double)total);
+    }
+
+    waves_draw_archive();
+}
+
+
+// zooms in (factor < 1) or out, keeping the right edge of the window in place
+void waves_zoom_archive(double factor)
+{
+    if (!view_shown) return;
+
+    uint64_t f = view_frames_per_line * factor;
+
+    // no closer than one archive entry per pixel, and no further out than
+    // needed to see all of the archive at once
+    if (f < archive_get_resolution() ||
+            (factor > 1.0 && view_frames_per_line * g_width > archive_get_frames())) {
+        return;
+    }
+
+    view_frames_per_line = f;
+    waves_draw_archive();
+}
+
+
+// how far back the right edge of the view is, and how long each column is, in seconds
+bool waves_get_archive_view(double *behind, double *column)
+{
+    if (!view_shown) {
+        return false;
+    }
+
+    *behind = view_follow ? 0.0 : (double)(archive_get_frames() - view_end) / audio_get_samplerate();
+    *column = (double)view_frames_per_line / audio_get_samplerate();
+    return true;
+}
+
+
+// analyzes nframes frames of nchannels ports, starting with port p
+static inline void waves_analyze_part(sample_t const *frames, unsigned int nframes, int stride, int nchannels,
+                                      int p, analyze_peak *peaks)
+{
+    analyze_frames(frames, nframes, stride, nchannels, peaks + p);
+    if (batch_histograms) {
+        analyze_histogram(frames, nframes, stride, nchannels, hists + p);
+    }
+}
+
+
+// analyzes ports p0 to p1 - 1 of the given column
+static inline void waves_analyze_column(waves_column const *column, int p0, int p1, analyze_peak *peaks)
+{
+    int nchannels = p1 - p0;
+
+    analyze_reset(peaks + p0, nchannels);
+    if (batch_histograms) {
+        analyze_hist_reset(hists + p0, nchannels);
+    }
+
+    // the column may wrap around the end of the buffer, even in the middle of a frame
+    unsigned int n = column->len / g_nports;
+    int r = column->len % g_nports;
+
+    if (n) {
+        waves_analyze_part(column->seg[0] + p0, n, g_nports, nchannels, p0, peaks);
+    }
+    if (n < column->nframes) {
+        sample_t const *f = column->seg[1];
+        if (r) {
+            // this frame is split in two
+            if (p0 < r) {
+                int e = min(p1, r);
+                waves_analyze_part(column->seg[0] + n * g_nports + p0, 1, e - p0, e - p0, p0, peaks);
+            }
+            if (p1 > r) {
+                int b = max(p0, r);
+                waves_analyze_part(f + (b - r), 1, p1 - b, p1 - b, b, peaks);
+            }
+            f += g_nports - r;
+            n++;
+        }
+        if (n < column->nframes) {
+            waves_analyze_part(f + p0, column->nframes - n, g_nports, nchannels, p0, peaks);
+        }
+    }
+}
+
+
+static void waves_density_to_spans(int, int, int, analyze_peak const *);
+
+static void waves_analyze_task(int i)
+{
+    int p0 = i * batch_ports;
+    int p1 = min(p0 + batch_ports, g_nports);
+
+    for (int c = 0; c < batch_size; c++) {
+        waves_analyze_column(&batch[c], p0, p1, batch_peaks + c * g_nports);
+        if (batch_histograms) {
+            waves_density_to_spans(c, p0, p1, batch_peaks + c * g_nports);
+        }
+    }
+}
+
+
+static inline void waves_peak_to_line(int ntrack, analyze_peak const *peak, waves_line *line)
+{
+    sample_t maxi = peak->maxi;
+    sample_t mini = peak->mini;
+    line->clipping = peak->clipping;
 
     // scale signal
     if (g_scales) {
@@ -160,29 +602,88 @@ static inline void waves_analyze_frames(int ntrack, waves_line *line)
 
     float upper = (draw_heights[ntrack] * (1.0f - maxi)) / 2;
     float lower = (draw_heights[ntrack] * (1.0f - mini)) / 2;
-    line->upper = max((int)floorf(upper), 0);
-    line->lower = min((int)ceilf(lower), draw_heights[ntrack]);
+    // clamp both ends, the whole column may be outside the visible range
+    line->upper = min(max((int)floorf(upper), 0), draw_heights[ntrack]);
+    line->lower = max(min((int)ceilf(lower), draw_heights[ntrack]), 0);
+
+    // the band is centered on zero, and never sticks out of the line.
+    // without a sum of squares (e.g. from the archive) it's empty
+    line->rms_upper = line->rms_lower = line->upper;
+    if (g_show_rms && peak->count) {
+        sample_t rms = analyze_rms(peak) * (g_scales ? g_scales[ntrack] : 1.0f);
+        float rms_upper = (draw_heights[ntrack] * (1.0f - rms)) / 2;
+        float rms_lower = (draw_heights[ntrack] * (1.0f + rms)) / 2;
+        line->rms_upper = min(max((int)floorf(rms_upper), line->upper), line->lower);
+        line->rms_lower = max(min((int)ceilf(rms_lower), line->lower), line->rms_upper);
+    }
 }
 
 
-static inline void waves_clear_line_all(int pos)
+// writes WAVES_SPANS_PER_TRACK spans and returns their number. with g_show_rms, those are
+// the line above the rms band, the band and the line below it, even if some are empty,
+// so each track has the same number of spans in every column
+static inline int waves_line_to_spans(int ntrack, waves_line *line, video_span *span)
 {
-    SDL_Rect r = { pos, 0, 1, g_height };
-    SDL_FillRect(video_get_draw_surface(), &r, 0);
+    bool clipping = line->clipping && g_show_clipping;
+    int y = track_yoffsets[ntrack];
+
+    span[0].y = y + line->upper;
+    span[0].color = clipping ? colors_clipping[ntrack] : colors[ntrack];
+
+    if (!g_show_rms) {
+        span[0].h = line->lower - line->upper;
+        return 1;
+    }
+
+    span[0].h = line->rms_upper - line->upper;
+    span[1].y = y + line->rms_upper;
+    span[1].h = line->rms_lower - line->rms_upper;
+    span[1].color = clipping ? colors_rms_clipping[ntrack] : colors_rms[ntrack];
+    span[2].y = y + line->rms_lower;
+    span[2].h = line->lower - line->rms_lower;
+    span[2].color = span[0].color;
+    return 3;
 }
 
 
-static inline void waves_draw_line(int pos, int ntrack, waves_line *line)
+// turns the histograms of ports p0 to p1 - 1 into the spans of column c of the batch.
+// the brightness goes down one level for every so many octaves fewer samples a row has
+// than the whole column. rows the signal just passes through still get the dimmest level,
+// so the column covers the same range as without g_density
+static void waves_density_to_spans(int c, int p0, int p1, analyze_peak const *peaks)
 {
-    SDL_Rect r = {
-        pos,
-        track_yoffsets[ntrack] + line->upper,
-        1,
-        line->lower - line->upper
-    };
-    Uint32 c = (line->clipping && g_show_clipping) ? colors_clipping[ntrack] : colors[ntrack];
+    float log_frames = log2f(batch[c].nframes);
 
-    SDL_FillRect(video_get_draw_surface(), &r, c);
+    for (int n = p0; n < p1; n++)
+    {
+        waves_line line;
+        waves_peak_to_line(n, &peaks[n], &line);
+
+        Uint32 const *ramp = (line.clipping && g_show_clipping ? ramps_clipping : ramps) + n * (DENSITY_LEVELS + 1);
+        video_span *s = batch_spans + c * g_height + track_yoffsets[n];
+        int count = 0, prev = 0;
+
+        for (int y = line.upper; y < line.lower; y++) {
+            unsigned int hits = analyze_hist_get(&hists[n], y);
+            int level = 1;
+            if (hits) {
+                level = DENSITY_LEVELS + (int)ceilf((log2f(hits) - log_frames) * (DENSITY_LEVELS / DENSITY_RANGE));
+                level = max(level, 1);
+            }
+
+            if (level == prev) {
+                s[count - 1].h++;
+            } else {
+                s[count].y = track_yoffsets[n] + y;
+                s[count].h = 1;
+                s[count].color = ramp[level];
+                count++;
+                prev = level;
+            }
+        }
+
+        batch_nspans[c * g_nports + n] = count;
+    }
 }
 
 
@@ -217,37 +718,526 @@ static void waves_draw_play_head_sdl(int pos)
 }
 
 
-void waves_draw()
+// draws the given peaks at draw_pos, or just clears the column if peaks is NULL.
+// a column that stands for skipped audio is drawn in grey
+static void waves_draw_column(analyze_peak const *peaks, bool skipped)
 {
-    int prev_pos = draw_pos;
-    int count = 0;
+    int nspans = 0;
+
+    if (density_column >= 0 && !skipped) {
+        // the spans of the batch's column, as they are
+        for (int n = 0; n < g_nports; n++) {
+            int k = batch_nspans[density_column * g_nports + n];
+            memcpy(spans + nspans, batch_spans + density_column * g_height + track_yoffsets[n], k * sizeof(video_span));
+            nspans += k;
+        }
+        peaks = NULL;
+    }
+
+    for (int n = 0; peaks && n < g_nports; n++)
+    {
+        waves_line line;
+        waves_peak_to_line(n, &peaks[n], &line);
+        int k = waves_line_to_spans(n, &line, &spans[nspans]);
+        if (skipped) {
+            for (int i = 0; i < k; i++) {
+                spans[nspans + i].color = color_skipped;
+            }
+        }
+        nspans += k;
+    }
+
+    // the tracks are stacked from top to bottom, so the spans are already sorted
+    video_draw_column(draw_pos, spans, nspans);
+    video_update_line(draw_pos);
+
+    draw_pos = (draw_pos + 1) % g_width;
+    new_columns++;
+}
+
+
+// describes nframes frames, starting offset samples into the given segments of the ring buffer
+static void waves_get_column(waves_column *column, sample_t const * const *seg, unsigned int seg_len,
+                             unsigned int offset, jack_nframes_t nframes)
+{
+    unsigned int samples = nframes * g_nports;
+
+    if (offset < seg_len) {
+        column->seg[0] = seg[0] + offset;
+        column->len = min(seg_len - offset, samples);
+        column->seg[1] = seg[1];
+    } else {
+        column->seg[0] = seg[1] + (offset - seg_len);
+        column->len = samples;
+        column->seg[1] = NULL;
+    }
+    column->nframes = nframes;
+}
+
 
-    while (audio_buffer_get_available() >= frames_per_line)
+// analyzes up to max_columns complete columns from the ring buffer, and passes each one on to done(),
+// along with the frame time of its last sample
+static void waves_analyze_frames(int max_columns, void (*done)(analyze_peak const *, jack_nframes_t))
+{
+    int available = min((int)(audio_buffer_get_available() / frames_per_line), max_columns);
+
+    // analyze the samples right where they are in the ring buffer, without copying them
+    jack_ringbuffer_data_t vec[2];
+    audio_buffer_get_read_vector(vec);
+
+    sample_t const *seg[2] = { (sample_t const *)vec[0].buf, (sample_t const *)vec[1].buf };
+    unsigned int seg_len = vec[0].len / sizeof(sample_t);
+    unsigned int offset = 0;
+    int64_t elapsed = 0;
+
+    while (available)
     {
+        int64_t t = stats_now();
+
+        batch_size = min(available, BATCH_COLUMNS);
+        batch_histograms = g_density;
+
+        for (int c = 0; c < batch_size; c++) {
+            waves_get_column(&batch[c], seg, seg_len, offset, frames_per_line);
+            offset += frames_per_line * g_nports;
+        }
+
+        workers_run(waves_analyze_task, (g_nports + batch_ports - 1) / batch_ports);
+        elapsed += stats_now() - t;
+
+        audio_buffer_read_advance(batch_size * frames_per_line);
+        available -= batch_size;
+
+        jack_nframes_t time = audio_buffer_get_time() - (jack_nframes_t)batch_size * frames_per_line;
+
+        for (int c = 0; c < batch_size; c++) {
+            time += frames_per_line;
+            density_column = batch_histograms ? c : -1;
+            done(batch_peaks + c * g_nports, time - 1);
+        }
+        density_column = -1;
+    }
+
+    // the time spent in done() doesn't count, that's drawing or passing the columns on
+    if (elapsed) {
+        stats_add(STATS_ANALYZE, elapsed);
+    }
+}
+
+
+static void waves_add_column(analyze_peak const *peaks, jack_nframes_t time)
+{
+    history_add(peaks);
+    archive_add(peaks, frames_per_line);
+    if (!view_shown) {
+        waves_draw_column(peaks, false);
+    }
+
+    column_time = time;
+    column_time_valid = true;
+}
+
+
+static void waves_add_skipped(analyze_peak const *peaks, jack_nframes_t ncolumns, jack_nframes_t time)
+{
+    skips++;
+    skipped_columns += ncolumns;
+
+    // the history keeps one column for every one skipped, so they still take up their time
+    // when the display is redrawn
+    history_add_repeated(peaks, ncolumns);
+    archive_add(peaks, ncolumns * frames_per_line);
+    if (!view_shown) {
+        waves_draw_column(peaks, true);
+    }
+
+    column_time = time;
+    column_time_valid = true;
+}
+
+
+static void waves_draw_frames(int max_columns)
+{
+    jack_nframes_t bound = waves_latency_columns();
+
+    if (!bound) {
         // this is just a simplistic safeguard in case we can't keep up with incoming audio samples.
         // the waveform might be garbled, but at least this way the program won't lock up completely.
-        if (++count > 4096) {
+        waves_analyze_frames(min(max_columns, 4096), waves_add_column);
+        return;
+    }
+
+    jack_nframes_t ncolumns = audio_buffer_get_available() / frames_per_line;
+
+    if (ncolumns > bound + 1) {
+        // analyze everything beyond the bound as one single column
+        jack_nframes_t nframes = (ncolumns - bound) * frames_per_line;
+
+        jack_ringbuffer_data_t vec[2];
+        audio_buffer_get_read_vector(vec);
+        sample_t const *seg[2] = { (sample_t const *)vec[0].buf, (sample_t const *)vec[1].buf };
+
+        waves_get_column(&batch[0], seg, vec[0].len / sizeof(sample_t), 0, nframes);
+        batch_size = 1;
+        batch_histograms = false;
+        workers_run(waves_analyze_task, (g_nports + batch_ports - 1) / batch_ports);
+        audio_buffer_read_advance(nframes);
+
+        waves_add_skipped(batch_peaks, ncolumns - bound, audio_buffer_get_time() - 1);
+    }
+
+    waves_analyze_frames(max_columns, waves_add_column);
+}
+
+
+static void waves_draw_peaks(int max_columns)
+{
+    int count = 0;
+    int limit = min(max_columns, 4096);
+    jack_nframes_t bound = waves_latency_columns();
+
+    if (bound) {
+        jack_nframes_t ncolumns = audio_peaks_get_available();
+
+        if (ncolumns > bound + 1) {
+            // merge everything beyond the bound into one single column
+            jack_nframes_t time = audio_peaks_read(skip_peaks);
+            for (jack_nframes_t n = 1; n < ncolumns - bound; n++) {
+                time = audio_peaks_read(peaks);
+                analyze_merge(skip_peaks, peaks, g_nports);
+            }
+            waves_add_skipped(skip_peaks, ncolumns - bound, time);
+            count++;
+        }
+        limit = max_columns;
+    }
+
+    // the samples have already been analyzed in the process callback or the analysis thread
+    while (count < limit && audio_peaks_get_available())
+    {
+        count++;
+
+        jack_nframes_t time = audio_peaks_read(peaks);
+        waves_add_column(peaks, time);
+    }
+
+    if (count && __atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+        // there's room in the queue again, the analysis thread may have been waiting for that
+        sem_post(&thread_wakeup);
+    }
+}
+
+
+// searches frames from to to - 1 of the ring buffer for the trigger, and returns the index
+// of the first frame that triggers, or to
+static jack_nframes_t waves_find_trigger(jack_nframes_t from, jack_nframes_t to)
+{
+    jack_ringbuffer_data_t vec[2];
+    audio_buffer_get_read_vector(vec);
+
+    // the ring buffer may wrap around in the middle of a frame
+    unsigned int seg_len = vec[0].len / sizeof(sample_t);
+    jack_nframes_t n = seg_len / g_nports;
+    int r = seg_len % g_nports;
+    sample_t const *seg[2] = { (sample_t const *)vec[0].buf, (sample_t const *)vec[1].buf };
+
+    if (from < n) {
+        jack_nframes_t end = min(to, n);
+        jack_nframes_t i = from + analyze_find_trigger(seg[0] + (size_t)from * g_nports, end - from,
+                                                       g_nports, g_trigger_port, &trigger);
+        if (i < end) return i;
+        from = end;
+    }
+    if (from >= to) {
+        return to;
+    }
+
+    if (r) {
+        if (from == n) {
+            // the frame that's split in two
+            sample_t const *s = g_trigger_port < r ? seg[0] + (size_t)n * g_nports + g_trigger_port
+                                                   : seg[1] + (g_trigger_port - r);
+            if (analyze_find_trigger(s, 1, 1, 0, &trigger) == 0) return n;
+            if (++from == to) return to;
+        }
+        seg[1] += g_nports - r;
+        n++;
+    }
+
+    return from + analyze_find_trigger(seg[1] + (size_t)(from - n) * g_nports, to - from,
+                                       g_nports, g_trigger_port, &trigger);
+}
+
+
+static void waves_add_sweep_column(analyze_peak const *peaks, jack_nframes_t time)
+{
+    waves_draw_column(peaks, false);
+
+    column_time = time;
+    column_time_valid = true;
+}
+
+
+// searches up to max_frames new frames for triggers, and draws the sweep of the last one
+// that's complete. the sweeps of earlier ones would only be drawn over before they're seen,
+// but they still count for the holdoff. returns the number of new frames used up
+static jack_nframes_t waves_draw_triggered(jack_nframes_t max_frames)
+{
+    jack_nframes_t available = audio_buffer_get_available();
+    jack_nframes_t sweep = g_width * frames_per_line;
+
+    if (trigger_scanned > available) {
+        // the ring buffer has been replaced, along with its contents
+        trigger_scanned = 0;
+        sweep_pending = false;
+    }
+
+    jack_nframes_t holdoff = g_trigger_holdoff / 1000.0f * audio_get_samplerate();
+    jack_nframes_t limit = trigger_scanned + min(available - trigger_scanned, max_frames);
+    jack_nframes_t used = limit - trigger_scanned;
+
+    int64_t t0 = stats_now();
+
+    jack_nframes_t pos = 0;
+    bool found = false;
+    jack_nframes_t last = 0;
+
+    for (;;)
+    {
+        jack_nframes_t t;
+
+        if (sweep_pending) {
+            t = 0;
+            sweep_pending = false;
+        } else {
+            if (pos >= limit) break;
+            if (holdoff_left) {
+                jack_nframes_t k = min(holdoff_left, limit - pos);
+                pos += k;
+                holdoff_left -= k;
+                if (holdoff_left) break;
+            }
+            t = waves_find_trigger(pos, limit);
+            pos = t;
+            if (t == limit) break;
+        }
+
+        if (available - t < sweep) {
+            // wait for the rest of the sweep, unless there's nothing more to come
+            if (audio_is_finished()) {
+                pos = available;
+            } else {
+                sweep_pending = true;
+            }
             break;
         }
 
-        waves_clear_line_all(g_use_gl ? 0 : draw_pos);
+        found = true;
+        last = t;
+        pos = t + sweep;
+        holdoff_left = holdoff;
+    }
+
+    stats_add(STATS_ANALYZE, stats_now() - t0);
+
+    if (found) {
+        audio_buffer_read_advance(last);
+        draw_pos = 0;
+        waves_analyze_frames(g_width, waves_add_sweep_column);
+        audio_buffer_read_advance(pos - last - sweep);
+        // the whole window has changed
+        video_invalidate();
+    } else {
+        audio_buffer_read_advance(pos);
+    }
+
+    // a sweep may reach beyond the frames searched
+    if (pos > limit) {
+        used += pos - limit;
+    }
+    trigger_scanned = sweep_pending ? limit - pos : 0;
+    return used;
+}
+
+
+// the number of complete columns waiting to be drawn
+static int waves_get_available()
+{
+    if (g_prereduce || g_analysis_thread) {
+        return audio_peaks_get_available();
+    } else if (g_trigger_port >= 0) {
+        // just what hasn't been searched for the trigger yet
+        jack_nframes_t available = audio_buffer_get_available();
+        return (available - min(trigger_scanned, available)) / frames_per_line;
+    } else {
+        return audio_buffer_get_available() / frames_per_line;
+    }
+}
+
+
+// whether there's more audio to come, from the audio source or the analysis thread
+static bool waves_more_to_come()
+{
+    if (!audio_is_finished()) {
+        return true;
+    }
+    if (!__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    // make sure the analysis thread isn't just about to pass on some more columns
+    pthread_mutex_lock(&thread_mutex);
+    bool pending = audio_buffer_get_available() >= frames_per_line;
+    pthread_mutex_unlock(&thread_mutex);
+
+    return pending;
+}
+
+
+// without a window, every frame stands for exactly 1/g_fps seconds of audio, no matter how
+// long it takes to render. waits until that much audio has arrived, and returns the number
+// of columns the frame advances by
+static int waves_wait_headless()
+{
+    headless_columns += (double)audio_get_samplerate() / g_fps / frames_per_line;
+    // (rounded up just a little, so a whole number of columns per frame doesn't come out one short)
+    int n = (int)(headless_columns + 1e-6);
+
+    while (g_run && waves_get_available() < n && waves_more_to_come()) {
+        usleep(1000);
+    }
+
+    return n;
+}
+
+
+void waves_draw()
+{
+    int prev_pos = draw_pos;
+    new_columns = 0;
+
+    int max_columns = g_headless ? waves_wait_headless() : INT_MAX;
+
+    // all new columns are written directly to the surface, it only needs to be locked once
+    video_lock();
 
-        for (int n = 0; n < g_nports; n++)
-        {
-            waves_line line;
-            audio_buffer_read(n, frames, frames_per_line);
-            waves_analyze_frames(n, &line);
-            waves_draw_line(g_use_gl ? 0 : draw_pos, n, &line);
+    if (g_trigger_port >= 0) {
+        // with g_headless, each frame stands for a fixed amount of audio. sweeps that went
+        // on beyond that are made up for in the next frames
+        jack_nframes_t budget = UINT_MAX;
+        if (g_headless) {
+            budget = max((int64_t)max_columns * frames_per_line - trigger_ahead, (int64_t)0);
         }
+        jack_nframes_t used = waves_draw_triggered(budget);
+        if (g_headless) {
+            trigger_ahead += (int64_t)used - (int64_t)max_columns * frames_per_line;
+        }
+    } else if (g_prereduce || g_analysis_thread) {
+        waves_draw_peaks(max_columns);
+    } else {
+        waves_draw_frames(max_columns);
+    }
 
-        video_update_line(draw_pos);
+    video_unlock();
 
-        draw_pos = (draw_pos + 1) % g_width;
+    if (view_shown && view_follow) {
+        waves_follow_archive();
     }
 
+    if (g_headless) {
+        headless_columns -= g_trigger_port >= 0 ? max_columns : new_columns;
+
+        if (!waves_more_to_come() && !waves_get_available()) {
+            // that was all, this is the last frame
+            g_run = false;
+        }
+    }
+
+    int64_t t = stats_now();
     video_update(draw_pos, prev_pos);
+    stats_add(STATS_UPLOAD, stats_now() - t);
+    stats_add_columns(new_columns);
 
-    if (!g_scrolling) {
+    // (the archive is drawn the same way while it follows what's being archived)
+    if (!g_scrolling && (!view_shown || view_follow) && g_trigger_port < 0) {
         waves_draw_play_head(draw_pos);
     }
 }
+
+
+static void * waves_thread(void *p)
+{
+    (void)p;
+
+    while (__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE))
+    {
+        sem_wait(&thread_wakeup);
+
+        // don't run ahead of the GUI thread by more than the queue can hold
+        pthread_mutex_lock(&thread_mutex);
+        waves_analyze_frames(audio_peaks_get_write_space(), audio_peaks_write);
+        pthread_mutex_unlock(&thread_mutex);
+    }
+
+    return NULL;
+}
+
+
+static void waves_start_thread()
+{
+    sem_init(&thread_wakeup, 0, 0);
+    __atomic_store_n(&thread_running, true, __ATOMIC_RELEASE);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (g_analysis_priority > 0) {
+        struct sched_param param = { .sched_priority = g_analysis_priority };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    int err = pthread_create(&thread, &attr, waves_thread, NULL);
+    if (err && g_analysis_priority > 0) {
+        // most likely not allowed to use realtime scheduling, run the thread anyway
+        fprintf(stderr, "can't set analysis thread priority: %s\n", strerror(err));
+        err = pthread_create(&thread, NULL, waves_thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+        fprintf(stderr, "can't create analysis thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (g_analysis_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(g_analysis_cpu, &cpus);
+        if ((err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus))) {
+            fprintf(stderr, "can't run analysis thread on cpu %d: %s\n", g_analysis_cpu, strerror(err));
+        }
+    }
+}
+
+
+// called by the audio code whenever new samples have been written
+void waves_wakeup()
+{
+    if (__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+        sem_post(&thread_wakeup);
+    }
+}
+
+
+void waves_lock()
+{
+    pthread_mutex_lock(&thread_mutex);
+}
+
+
+void waves_unlock()
+{
+    pthread_mutex_unlock(&thread_mutex);
+}
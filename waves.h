@@ -12,11 +12,29 @@
 #ifndef _WAVES_H
 #define _WAVES_H
 
+#include <stdbool.h>
+#include <jack/types.h>
+
 void waves_init();
+void waves_stop_thread();
 void waves_adjust();
 void waves_draw();
 
 int waves_samples_per_pixel();
 int waves_samples_per_frame();
 
+unsigned long waves_get_skips();
+unsigned long waves_get_skipped_columns();
+bool waves_get_column_time(jack_nframes_t *time);
+
+void waves_toggle_archive();
+bool waves_archive_shown();
+void waves_scroll_archive(double screens);
+void waves_zoom_archive(double factor);
+bool waves_get_archive_view(double *behind, double *column);
+
+void waves_wakeup();
+void waves_lock();
+void waves_unlock();
+
 #endif // _WAVES_H
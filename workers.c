@@ -0,0 +1,149 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * a fixed pool of threads that share the work of a single call to
+ * workers_run(). the tasks are divided into one contiguous range per worker,
+ * and a worker that has finished its own range steals the remaining tasks
+ * from the others, so slow or preempted workers don't hold up the rest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "workers.h"
+
+
+// the tasks that haven't been claimed yet. each range gets a cache line of its own,
+// as all workers keep incrementing the counters
+typedef struct {
+    int next;
+    int end;
+    char pad[64 - 2 * sizeof(int)];
+} workers_range;
+
+
+static void workers_exit();
+
+static int nworkers = 1;
+static pthread_t *threads = NULL;
+static workers_range *ranges = NULL;
+static sem_t start, done;
+static bool running = false;
+
+static void (*current_task)(int);
+
+
+static void workers_work(int w)
+{
+    // our own range first, then help out the others
+    for (int k = 0; k < nworkers; k++)
+    {
+        workers_range *r = &ranges[(w + k) % nworkers];
+        int i;
+
+        while ((i = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED)) < r->end) {
+            current_task(i);
+        }
+    }
+}
+
+
+static void * workers_thread(void *p)
+{
+    int w = (int)(intptr_t)p;
+
+    for (;;)
+    {
+        sem_wait(&start);
+        if (!running) break;
+
+        workers_work(w);
+        sem_post(&done);
+    }
+
+    return NULL;
+}
+
+
+void workers_init(int n)
+{
+    nworkers = n > 1 ? n : 1;
+
+    if (nworkers == 1) {
+        return;
+    }
+
+    ranges = (workers_range*)calloc(nworkers, sizeof(workers_range));
+
+    sem_init(&start, 0, 0);
+    sem_init(&done, 0, 0);
+    running = true;
+
+    // the thread calling workers_run() is worker 0
+    threads = (pthread_t*)calloc(nworkers, sizeof(pthread_t));
+    for (int w = 1; w < nworkers; w++) {
+        if (pthread_create(&threads[w], NULL, workers_thread, (void*)(intptr_t)w)) {
+            fprintf(stderr, "can't create worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    atexit(workers_exit);
+}
+
+
+static void workers_exit()
+{
+    running = false;
+
+    for (int w = 1; w < nworkers; w++) {
+        sem_post(&start);
+    }
+    for (int w = 1; w < nworkers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    sem_destroy(&start);
+    sem_destroy(&done);
+    free(threads);
+    free(ranges);
+}
+
+
+void workers_run(void (*task)(int), int ntasks)
+{
+    if (nworkers == 1 || ntasks == 1) {
+        for (int i = 0; i < ntasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    current_task = task;
+    for (int w = 0; w < nworkers; w++) {
+        ranges[w].next = ntasks * w / nworkers;
+        ranges[w].end = ntasks * (w + 1) / nworkers;
+    }
+
+    // the semaphores also make sure everyone sees the ranges, and we see all results
+    for (int w = 1; w < nworkers; w++) {
+        sem_post(&start);
+    }
+    workers_work(0);
+    for (int w = 1; w < nworkers; w++) {
+        sem_wait(&done);
+    }
+}
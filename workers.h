@@ -0,0 +1,21 @@
+/*
+ * jack_oscrolloscope
+ *
+ * Copyright (C) 2006-2011  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+void workers_init(int nworkers);
+
+// calls task(0) ... task(ntasks - 1), spread over all workers including the calling thread,
+// and returns when they're all done
+void workers_run(void (*task)(int), int ntasks);
+
+#endif // _WORKERS_H